@@ -0,0 +1,85 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all 
+copyright and related and neighboring rights to this software to the 
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication 
+along with this software. If not, 
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/*************************************************
+Regret of UCB when rewards arrive late
+*************************************************/
+
+#include "gaussian_bandit.h"
+#include "algs.h"
+#include "delay.h"
+
+#include <vector>
+#include <iostream>
+#include <random>
+
+using namespace std;
+
+/* with no delay the delayed simulator must reproduce the ordinary one exactly */
+bool CheckNoDelay(string name, IndexAlgorithm &alg, default_random_engine &gen, vector<double> mus, uint64_t n) {
+  GaussianBandit bandit(mus, gen);
+  FixedDelay none(0);
+  gen.seed(1);
+  double r1 = alg.sim(bandit, n);
+  gen.seed(1);
+  double r2 = alg.sim(bandit, n, none);
+  cout << name << ": regret " << r1 << " without delay, " << r2 << " with a delay of 0\n";
+  return r1 == r2;
+}
+
+int main() {
+  random_device rd;
+  default_random_engine gen(rd());
+  uint64_t n = 100000;
+  int samples = 100;
+  vector<double> mus = {0, -0.1, -0.1, -0.5};
+
+  default_random_engine check(1);
+  UCB ucb2(2.0);
+  MOSS moss;
+  OCUCB ocucb(3.0, 2.0);
+  AOCUCB aocucb(2.0);
+  AnytimeOCUCB anytime(2.0, 0.5);
+  OptAnytimeOCUCB opt(2.0, 0.5);
+  GaussianTS ts(check);
+  GaussianGittins gittins;
+  GaussianGittinsApprox approx;
+  bool ok = CheckNoDelay("UCB", ucb2, check, mus, 10000);
+  ok = CheckNoDelay("MOSS", moss, check, mus, 10000) && ok;
+  ok = CheckNoDelay("OCUCB", ocucb, check, mus, 10000) && ok;
+  ok = CheckNoDelay("AOCUCB", aocucb, check, mus, 10000) && ok;
+  ok = CheckNoDelay("AnytimeOCUCB", anytime, check, mus, 10000) && ok;
+  ok = CheckNoDelay("OptAnytimeOCUCB", opt, check, mus, 10000) && ok;
+  ok = CheckNoDelay("GaussianTS", ts, check, mus, 10000) && ok;
+  ok = CheckNoDelay("GaussianGittins", gittins, check, mus, 200) && ok;
+  ok = CheckNoDelay("GaussianGittinsApprox", approx, check, mus, 10000) && ok;
+  if (!ok) {
+    cout << "the delayed simulator does not match the ordinary one\n";
+    return 1;
+  }
+
+  GaussianBandit bandit(mus, gen);
+  UCB ucb(2.0);
+
+  /* rewards arrive after a geometrically distributed number of rounds */
+  for (double mean : {0.0, 10.0, 100.0, 1000.0}) {
+    GeometricDelay delay(mean, gen);
+    double r = 0.0;
+    for (int i = 0;i != samples;++i) {
+      r+=ucb.sim(bandit, n, delay);
+    }
+    cout << "mean delay " << mean << ": average regret of UCB is " << r / samples << "\n";
+  }
+  return 0;
+}
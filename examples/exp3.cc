@@ -0,0 +1,61 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/*************************************************
+Runs EXP3 and EXP3-IX for long enough that the
+weights of the bad arms fall hundreds of e-folds
+below the best arm, and checks they stay finite
+*************************************************/
+
+#include "bandit.h"
+#include "bernoulli_bandit.h"
+#include "algs.h"
+
+#include <vector>
+#include <iostream>
+#include <random>
+#include <cmath>
+
+using namespace std;
+
+bool Finite(string name, EXP3 &alg, BernoulliBandit &bandit, uint64_t n) {
+  double regret = alg.sim(bandit, n);
+  auto &logw = alg.log_weights();
+  double lo = logw[0];
+  for (double w : logw) {
+    if (!isfinite(w)) {
+      cout << name << ": non-finite log weight " << w << "\n";
+      return false;
+    }
+    lo = min(lo, w);
+  }
+  cout << name << ": regret " << regret << ", log weights span " << logw[0] - lo << "\n";
+  return isfinite(regret);
+}
+
+int main() {
+  random_device rd;
+  default_random_engine gen(rd());
+  uint64_t K = 100;
+  uint64_t n = 10000000;
+  vector<double> mus(K, 0.0);
+  mus[0] = 1.0;
+
+  BernoulliBandit bandit(mus, gen);
+  EXP3 exp3(0.0, 1.0, gen);
+  EXP3IX exp3ix(0.0, 1.0, gen);
+  bool ok = Finite("EXP3", exp3, bandit, n);
+  ok = Finite("EXP3-IX", exp3ix, bandit, n) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all 
+copyright and related and neighboring rights to this software to the 
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication 
+along with this software. If not, 
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/*************************************************
+Fixed-confidence best-arm identification
+*************************************************/
+
+#include "gaussian_bandit.h"
+#include "explore.h"
+
+#include <vector>
+#include <iostream>
+#include <random>
+
+using namespace std;
+
+int main() {
+  random_device rd;
+  default_random_engine gen(rd());
+  int samples = 100;
+  double delta = 0.01;
+  vector<double> mus = {0, -0.2, -0.2, -0.5, -0.5, -1.0};
+
+  GaussianBandit bandit(mus, gen);
+  RoundRobin rr;
+  TopTwo tt(0.5, gen);
+
+  for (int i = 0;i != samples;++i) {
+    Identification r1 = rr.identify(bandit, delta, 100000000);
+    Identification r2 = tt.identify(bandit, delta, 100000000);
+    /* stopping time and correctness of each replicate */
+    cout << r1.tau << " " << r1.correct << " " << r2.tau << " " << r2.correct << "\n";
+  }
+  return 0;
+}
@@ -45,35 +45,36 @@ int main() {
   vector<double> means = {0, 0.1};            
 
 
+  /* every worker thread gets its own generator, bandit and algorithm the first time it runs a job, and reuses
+  them for all later jobs */
+  struct Context {
+    Context(vector<double> means) : gen(random_device()()), bandit(means, gen), ucb(2.0) {
+    }
+
+    default_random_engine gen;
+    GaussianBandit bandit;
+    UCB ucb;
+  };
+  WorkerLocal<Context> local(max_threads, [means](int i) {
+    return new Context(means);
+  });
+
   /* create job list with `max_threads` threads at most, returning doubles */
   Pool<double> pool(max_threads);
   
   for (int i = 0;i != samples;++i) {
-    pool.push([means,horizon] {
-      /* for seeding our random number generator */
-      random_device rd;
-
-      /* we need random numbers */
-      default_random_engine gen(rd());                  
-
-
+    pool.push([&local,horizon] {
+      Context &c = local.get();
 
-      /* create a gaussian bandit */
-      GaussianBandit bandit(means, gen);
-      UCB ucb(2.0);
-
-      /* create a UCB algorithm with alpha = 2 */
-      return ucb.sim(bandit, horizon);
+      /* run UCB with alpha = 2 on the gaussian bandit */
+      return c.ucb.sim(c.bandit, horizon);
     });
   }
   
-  vector<double> data = pool.run();
-
-  double R_ucb = 0.0;
-
-  for (auto r : data) {
-    R_ucb+=r;
-  }
+  /* sum the regrets as the jobs finish, the total does not depend on the number of threads */
+  double R_ucb = pool.reduce([](double a, double b) {
+    return a + b;
+  });
 
   /* output the average regret */
   cout << "average regret of UCB is " << R_ucb / samples << "\n";
@@ -0,0 +1,73 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/*************************************************
+Records a long run of UCB, spilling the trajectory
+to disk, and replays it
+*************************************************/
+
+#include "gaussian_bandit.h"
+#include "algs.h"
+#include "trajectory.h"
+
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <cmath>
+
+using namespace std;
+
+uint64_t FileSize(string fn) {
+  ifstream in(fn, ios::binary | ios::ate);
+  return in ? (uint64_t)in.tellg() : 0;
+}
+
+int main() {
+  random_device rd;
+  default_random_engine gen(rd());
+  uint64_t n = 1000000;
+  vector<double> mus = {0, -0.1, -0.5};
+
+  /* keep the rewards, and move them to trajectory.actions and trajectory.rewards once they pass 1MB */
+  GaussianBanditWithLogging bandit(mus, gen, true, "trajectory");
+  UCB ucb(2.0);
+  double regret = ucb.sim(bandit, n);
+  Trajectory &t = bandit.trajectory;
+  t.flush();
+  cout << t.pulls() << " pulls in " << t.runs() << " runs, " << t.memory() << " bytes in memory, "
+       << FileSize("trajectory.actions") << " + " << FileSize("trajectory.rewards") << " bytes on disk\n";
+
+  /* replay the pulls, and keep the rewards rounded to whole numbers in a second trajectory */
+  Trajectory rounded(true);
+  vector<uint64_t> pulls(mus.size(), 0);
+  vector<double> total(mus.size(), 0.0);
+  t.for_each_pull([&](int arm, double reward) {
+    pulls[arm]++;
+    total[arm]+=reward;
+    rounded.record(arm, round(reward));
+  });
+  double replayed = 0.0;
+  for (size_t i = 0;i != mus.size();++i) {
+    cout << "arm " << i << ": " << pulls[i] << " pulls, mean reward " << total[i] / max(pulls[i], (uint64_t)1) << "\n";
+    replayed+=(mus[0] - mus[i]) * pulls[i];
+  }
+  cout << "regret " << regret << ", from the replay " << replayed << "\n";
+
+  /* random doubles are stored as they are, rounded rewards XOR code to a few bytes */
+  cout << "rounded rewards take " << rounded.memory() << " bytes in memory\n";
+
+  t.clear();
+  return 0;
+}
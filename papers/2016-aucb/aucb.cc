@@ -113,6 +113,9 @@ void do_experiment2(default_random_engine gen, string fn) {
 
 
 int main(int argc, char *argv[]) {
+  /* flush the logs if the run is interrupted */
+  LogSink::catch_signals();
+
   /* seed random number generate */
   default_random_engine gen;
   random_device rd;
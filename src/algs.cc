@@ -18,6 +18,7 @@ see http://creativecommons.org/publicdomain/zero/1.0/
 #include <cfloat>
 #include <cmath>
 #include <algorithm>
+#include <numeric>
 #include <iostream>
 #include <limits>
 #include <queue>
@@ -35,42 +36,133 @@ double IndexAlgorithm::sim(BanditProblem &bp, uint64_t horizon) {
   n = horizon;
 
   bp.reset();
+  init(bp);
   arms.clear();
 
   for (uint64_t i = 0;i != K;++i) {
     arms.push_back(Arm(i, std::numeric_limits<double>::max()));
     arms.rbegin()->max_idx = std::numeric_limits<double>::max();
   }
+  position.resize(K);
+  iota(position.begin(), position.end(), 0);
 
   uint64_t t = 0;
   for (;t != K && t !=n;++t) {
-    arms[t].pull(bp.choose(arms[t].i));
+    arms[position[t]].pull(bp.choose(t));
+    to_front(t);
   }
-  
+
   for (;t != n;++t) {
-    auto best_idx = -numeric_limits<double>::max();
-    auto best = arms.begin();
     auto last = arms.begin();
+    auto best = select(t, last);
+    int i = best->i;
 
-    for (auto a = arms.begin();a!=arms.end();++a) {
-      if (a->max_idx < best_idx) {
-        break;
-      }
-      last = a;
+    best->pull(bp.choose(i));
+
+    update(best);
+
+    /* the same steps as the delayed simulator takes when a reward arrives at once */
+    reorder(last);
+    to_front(i);
+  }
+  return bp.get_regret();
+}
+
+/* find the arm with the largest index, computing only those indices that might beat the leader.
+`last` is set to the last arm whose index was computed */
+vector<Arm>::iterator IndexAlgorithm::select(uint64_t t, vector<Arm>::iterator &last) {
+  auto best_idx = -numeric_limits<double>::max();
+  auto best = arms.begin();
+
+  for (auto a = arms.begin();a!=arms.end();++a) {
+    if (a->max_idx < best_idx) {
+      break;
+    }
+    last = a;
+    if (a->T == 0) {
+      /* no reward has arrived yet (only possible with delayed feedback) */
+      a->idx = numeric_limits<double>::max();
+    }else {
       set_index(a, t);
+    }
 
-      if (a->idx > best_idx) {
-        best_idx = a->idx;
-        best = a;
-      }
+    if (a->idx > best_idx) {
+      best_idx = a->idx;
+      best = a;
     }
-    best->max_idx = numeric_limits<double>::max();
-    best->pull(bp.choose(best->i));
+  }
+  return best;
+}
 
-    update(best);
+/* restore the ordering by max_idx after the arms up to `last` have changed, and update `position` for the
+arms that moved */
+void IndexAlgorithm::reorder(vector<Arm>::iterator last) {
+  auto by_max_idx = [](const Arm &a1, const Arm &a2) {return a1.max_idx > a2.max_idx;};
+  sort(arms.begin(), last+1, by_max_idx);
+  /* arms below every changed arm keep their place */
+  double lowest = last->max_idx;
+  auto end = partition_point(last+1, arms.end(), [lowest](const Arm &a) {return a.max_idx > lowest;});
+  inplace_merge(arms.begin(), last+1, end, by_max_idx);
+  for (auto a = arms.begin();a != end;++a) {
+    position[a->i] = a - arms.begin();
+  }
+}
+
+
+/* marks arm i as changed and moves it alone to the front, the arms it passes shift back by one */
+void IndexAlgorithm::to_front(uint64_t i) {
+  auto a = arms.begin() + position[i];
+  a->max_idx = numeric_limits<double>::max();
+  rotate(arms.begin(), a, a + 1);
+  for (auto b = arms.begin();b != a + 1;++b) {
+    position[b->i] = b - arms.begin();
+  }
+}
+
+
+/*************************************************************
+DELAYED FEEDBACK SIMULATOR
+*************************************************************/
+double IndexAlgorithm::sim(BanditProblem &bp, uint64_t horizon, Delay &delay) {
+  K = bp.K;
+  n = horizon;
+
+  bp.reset();
+  init(bp);
+  arms.clear();
+  pending.reset();
+
+  for (uint64_t i = 0;i != K;++i) {
+    arms.push_back(Arm(i, std::numeric_limits<double>::max()));
+    arms.rbegin()->max_idx = std::numeric_limits<double>::max();
+  }
+  position.resize(K);
+  iota(position.begin(), position.end(), 0);
 
-    sort(arms.begin(), last+1, [](const Arm &a1, const Arm &a2) {return a1.max_idx > a2.max_idx;});
-    inplace_merge(arms.begin(), last+1, arms.end(), [](const Arm &a1, const Arm &a2) {return a1.max_idx > a2.max_idx;});
+  uint64_t t = 0;
+  for (;t != K && t !=n;++t) {
+    pending.push(t + 1 + delay.sample(), Feedback{arms[t].i, bp.choose(arms[t].i)});
+  }
+
+  for (;t != n;++t) {
+    pending.pop(t, [&](const Feedback &f) {
+      auto a = arms.begin() + position[f.i];
+      /* as in the simulator above, the first reward of each arm is not passed to update */
+      bool first = a->T == 0;
+      a->pull(f.r);
+      if (!first) {
+        update(a);
+      }
+      to_front(f.i);
+    });
+
+    auto last = arms.begin();
+    auto best = select(t, last);
+
+    /* the statistics of `best` do not change until its reward arrives, so max_idx stays valid */
+    pending.push(t + 1 + delay.sample(), Feedback{best->i, bp.choose(best->i)});
+
+    reorder(last);
   }
   return bp.get_regret();
 }
@@ -123,17 +215,85 @@ void GaussianTS::set_index(vector<Arm>::iterator a, uint64_t t) {
 }
 
 void GaussianGittins::set_index(vector<Arm>::iterator a, uint64_t t) {
-  a->idx = a->mean() + table.get_idx(n - t, a->T);
+  a->idx = a->mean() + index(n - t, a->T);
+  a->max_idx = a->idx;
+}
+
+double GaussianGittins::index(uint64_t m, uint64_t T) {
+  if (table.contains(m, T)) {
+    return table.get_idx(m, T);
+  }
+  if (m == 1) {
+    return 0.0;
+  }
+  /* (m, T) lies on diagonal m + T */
+  auto d = local.find(m + T);
+  if (d == local.end()) {
+    if (cache->approximate(m, T)) {
+      return GittinsApprox(m, T);
+    }
+    if (local.size() >= 1024) {
+      local.clear();
+    }
+    d = local.insert(make_pair(m + T, cache->get(m + T))).first;
+  }
+  return (*d->second)[m];
+}
+
+void GaussianDiscountedGittins::set_index(vector<Arm>::iterator a, uint64_t t) {
+  a->idx = a->mean() + table.get_idx(a->T);
+  a->max_idx = a->idx;
+}
+
+void BernoulliGittins::set_index(vector<Arm>::iterator a, uint64_t t) {
+  uint64_t s = round(a->reward);
+  a->idx = table.get_idx(n - t, s, a->T - s);
   a->max_idx = a->idx;
 }
 
 void GaussianGittinsApprox::set_index(vector<Arm>::iterator a, uint64_t t) {
-  uint64_t m = n - t;
-  double beta = max(1.0, min(m / pow(log(m), 1.5) / 4.0, m / 4.0 / a->T / pow(log(m/a->T), 0.5)));
-  a->idx = a->mean() + sqrt(2.0 / a->T * log(beta));
+  a->idx = a->mean() + GittinsApprox(n - t, a->T);
   a->max_idx = a->idx;
 }
 
 
+/*************************************************************
+EXP3 AND EXP3-IX
+*************************************************************/
+double EXP3::sim(BanditProblem &bp, uint64_t horizon) {
+  K = bp.K;
+  bp.reset();
+
+  logw.assign(K, 0.0);
+  offset = 0.0;
+  tree.reset(K);
+  tree.build(K, [](int i) {return 1.0;});
+
+  double eta = sqrt(2.0 * log((double)K) / (horizon * K));
+  double gamma = ix ? eta / 2.0 : 0.0;
+  uniform_real_distribution<double> unif(0.0, 1.0);
+
+  for (uint64_t t = 0;t != horizon;++t) {
+    double W = tree.total();
+    int i = tree.find(unif(gen) * W);
+    /* an arm whose weight underflowed has p = 0, and plain EXP3 would divide by it */
+    double p = max(tree.get(i) / W, 1e-100);
 
+    double x = (bp.choose(i) - lo) / (hi - lo);
+    double loss = 1.0 - max(0.0, min(1.0, x));
 
+    /* only the weight of the played arm changes */
+    logw[i]-=eta * loss / (p + gamma);
+    tree.set(i, exp(logw[i] - offset));
+    if (tree.total() < 1e-100) {
+      rescale();
+    }
+  }
+  return bp.get_regret();
+}
+
+/* move the offset to the largest log weight, O(K) but rare */
+void EXP3::rescale() {
+  offset = *max_element(logw.begin(), logw.end());
+  tree.build(K, [this](int i) {return exp(logw[i] - offset);});
+}
@@ -17,10 +17,14 @@ see http://creativecommons.org/publicdomain/zero/1.0/
 
 #include "bandit.h"
 #include "gittins_table.h"
+#include "gittins.h"
 #include "arm.h"
+#include "delay.h"
 
 #include <cstdint>
+#include <memory>
 #include <random>
+#include <unordered_map>
 #include <vector>
 
 
@@ -83,13 +87,81 @@ class SortedLookup {
 };
 
 
+/*************************************************************
+* SUM TREE FOR O(log K) SAMPLING IN EXP3
+*************************************************************/
+class SumTree {
+  public:
+  void reset(int K) {
+    P = 1;
+    while (P < K) {
+      P *= 2;
+    }
+    node.assign(2 * P, 0.0);
+  }
+
+  double get(int i)const {
+    return node[P + i];
+  }
+
+  void set(int i, double w) {
+    int j = P + i;
+    node[j] = w;
+    /* recompute rather than add differences so rounding errors do not accumulate */
+    for (j/=2;j != 0;j/=2) {
+      node[j] = node[2 * j] + node[2 * j + 1];
+    }
+  }
+
+  /* set every leaf, then fix the internal nodes in O(K) */
+  template<class F> void build(int K, F w) {
+    for (int i = 0;i != K;++i) {
+      node[P + i] = w(i);
+    }
+    for (int j = P - 1;j != 0;--j) {
+      node[j] = node[2 * j] + node[2 * j + 1];
+    }
+  }
+
+  double total()const {
+    return node[1];
+  }
+
+  /* returns the leaf i with prefix(i) <= x < prefix(i+1) for x in [0, total) */
+  int find(double x)const {
+    int j = 1;
+    while (j < P) {
+      if (x < node[2 * j] || node[2 * j + 1] == 0.0) {
+        j = 2 * j;
+      }else {
+        x-=node[2 * j];
+        j = 2 * j + 1;
+      }
+    }
+    return j - P;
+  }
+
+  private:
+  int P;
+  std::vector<double> node;
+};
+
+
 class IndexAlgorithm {
   public:
   double sim(BanditProblem &bp, uint64_t horizon);
 
+  /* as above, but each reward arrives `delay` rounds after the pull and the
+  indices are computed from whatever has arrived so far */
+  double sim(BanditProblem &bp, uint64_t horizon, Delay &delay);
+
   protected:
   virtual void set_index(std::vector<Arm>::iterator, uint64_t t) = 0;
 
+  /* called at the start of every simulation */
+  virtual void init(BanditProblem &bp) {
+  }
+
   virtual void update(std::vector<Arm>::iterator) {
   }
 
@@ -99,6 +171,17 @@ class IndexAlgorithm {
   std::vector<Arm> arms;
 
   private:
+  std::vector<Arm>::iterator select(uint64_t t, std::vector<Arm>::iterator &last);
+  void reorder(std::vector<Arm>::iterator last);
+  void to_front(uint64_t i);
+
+  struct Feedback {
+    int i;
+    double r;
+  };
+  DelayQueue<Feedback> pending;
+  /* position[i] is the place of arm i in `arms` */
+  std::vector<uint64_t> position;
 };
 
 
@@ -138,11 +221,10 @@ class AnytimeOCUCB : public IndexAlgorithm {
   AnytimeOCUCB(double alpha, double rho) : alpha(alpha), rho(rho) {
   }
 
-  double sim(BanditProblem &bp, uint64_t horizon) {
+  protected:
+  void init(BanditProblem &bp) {
     lookup = SortedLookup(bp.K, rho);
-    return IndexAlgorithm::sim(bp, horizon);
   }
-  protected:
   void update(std::vector<Arm>::iterator); 
   void set_index(std::vector<Arm>::iterator, uint64_t t);
 
@@ -156,11 +238,10 @@ class OptAnytimeOCUCB : public IndexAlgorithm {
   public:
   OptAnytimeOCUCB(double alpha, double rho) : alpha(alpha), rho(rho) {
   }
-  double sim(BanditProblem &bp, uint64_t horizon) {
+  protected:
+  void init(BanditProblem &bp) {
     lookup = SortedLookup(bp.K, rho);
-    return IndexAlgorithm::sim(bp, horizon);
   }
-  protected:
   void update(std::vector<Arm>::iterator); 
   void set_index(std::vector<Arm>::iterator, uint64_t t);
 
@@ -180,13 +261,45 @@ class GaussianTS : public IndexAlgorithm {
   std::normal_distribution<double> dist;
 };
 
+/* indices outside the table are computed on demand and kept in a cache shared by all instances */
 class GaussianGittins : public IndexAlgorithm {
   public:
-  GaussianGittins(std::string fn) : table(fn) {
+  GaussianGittins(std::string fn, std::shared_ptr<GittinsCache> cache = GittinsCache::shared()) : table(fn), cache(cache) {
+  }
+  /* shares the indices of table, which may be a per-node replica */
+  GaussianGittins(const GittinsTable &table, std::shared_ptr<GittinsCache> cache = GittinsCache::shared()) : table(table),
+  cache(cache) {
+  }
+  /* without a table every index is computed */
+  GaussianGittins(std::shared_ptr<GittinsCache> cache = GittinsCache::shared()) : table((uint64_t)0), cache(cache) {
   }
   private:
   void set_index(std::vector<Arm>::iterator, uint64_t t);
+  double index(uint64_t m, uint64_t T);
   GittinsTable table;
+  std::shared_ptr<GittinsCache> cache;
+  /* diagonals this instance has fetched from the cache, avoids taking its lock */
+  std::unordered_map<uint64_t, GittinsCache::Diagonal> local;
+};
+
+/* the discounted index does not depend on the horizon, so this suits very long runs */
+class GaussianDiscountedGittins : public IndexAlgorithm {
+  public:
+  GaussianDiscountedGittins(std::string fn) : table(fn) {
+  }
+  private:
+  void set_index(std::vector<Arm>::iterator, uint64_t t);
+  DiscountedGittinsTable table;
+};
+
+/* rewards must be 0 or 1, indices come from a table built by `makegittins bernoulli` */
+class BernoulliGittins : public IndexAlgorithm {
+  public:
+  BernoulliGittins(std::string fn) : table(fn) {
+  }
+  private:
+  void set_index(std::vector<Arm>::iterator, uint64_t t);
+  BernoulliGittinsTable table;
 };
 
 class GaussianGittinsApprox : public IndexAlgorithm {
@@ -194,6 +307,51 @@ class GaussianGittinsApprox : public IndexAlgorithm {
 };
 
 
+/*************************************************************
+* ADVERSARIAL ALGORITHMS
+*
+* Rewards are clipped to [lo, hi] and rescaled to losses in
+* [0, 1]. Weights are kept in log space; the sum tree holds
+* exp(log w - offset) and is only rebuilt when the weights
+* drift far enough from the offset to risk underflow.
+*************************************************************/
+class EXP3 {
+  public:
+  EXP3(double lo, double hi, std::default_random_engine &gen) : lo(lo), hi(hi), gen(gen), ix(false) {
+  }
+
+  double sim(BanditProblem &bp, uint64_t horizon);
+
+  /* log weights at the end of the last sim */
+  const std::vector<double> &log_weights()const {
+    return logw;
+  }
+
+  protected:
+  double lo;
+  double hi;
+  std::default_random_engine &gen;
+
+  /* use the implicit exploration loss estimate */
+  bool ix;
+
+  private:
+  void rescale();
+
+  uint64_t K;
+  std::vector<double> logw;
+  double offset;
+  SumTree tree;
+};
+
+class EXP3IX : public EXP3 {
+  public:
+  EXP3IX(double lo, double hi, std::default_random_engine &gen) : EXP3(lo, hi, gen) {
+    ix = true;
+  }
+};
+
+
 
 
 
@@ -0,0 +1,85 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/************************************************************
+Byte codings shared by the log and trajectory formats.
+
+Varints store 7 bits per byte, low bits first, with the top bit
+set on every byte but the last.
+
+Sequences of doubles are XOR coded: each value is XORed with the
+one before and stored as a byte holding the number of leading
+(high nibble) and trailing zero bytes of the result, followed by
+the bytes in between. Repeated and nearby values take one to a few
+bytes, random values nine.
+************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+
+inline void PutVarint(uint64_t v, std::string &out) {
+  while (v >= 0x80) {
+    out.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((char)v);
+}
+
+/* get() returns the next byte */
+template<class Get> uint64_t GetVarint(Get &&get) {
+  uint64_t v = 0;
+  for (int shift = 0;;shift+=7) {
+    uint8_t b = get();
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (b < 0x80) {
+      return v;
+    }
+  }
+}
+
+/* prev is the bit pattern of the previous value, 0 at the start */
+inline void PutXor(double x, uint64_t &prev, std::string &out) {
+  uint64_t v;
+  memcpy(&v, &x, 8);
+  uint64_t d = v ^ prev;
+  prev = v;
+  int lead = 0, trail = 0;
+  while (lead != 8 && (d >> (56 - 8 * lead) & 0xff) == 0) {
+    lead++;
+  }
+  while (lead + trail != 8 && (d >> (8 * trail) & 0xff) == 0) {
+    trail++;
+  }
+  out.push_back((char)(lead << 4 | trail));
+  for (int b = trail;b != 8 - lead;++b) {
+    out.push_back((char)(d >> (8 * b)));
+  }
+}
+
+template<class Get> double GetXor(uint64_t &prev, Get &&get) {
+  uint8_t c = get();
+  int lead = c >> 4;
+  int trail = c & 15;
+  uint64_t d = 0;
+  for (int b = trail;b != 8 - lead;++b) {
+    d |= (uint64_t)(uint8_t)get() << (8 * b);
+  }
+  prev^=d;
+  double x;
+  memcpy(&x, &prev, 8);
+  return x;
+}
@@ -45,12 +45,11 @@ class Data {
     return data.size();
   }
 
+  /* the element a full sort would put at position p * size, found in linear time. This reorders data */
   double quantile(double p) {
-    if (!sorted) {
-      std::sort(data.begin(), data.end());
-    }
-    sorted = true;
-    return data[(int)(p * data.size())];
+    auto q = data.begin() + (int)(p * data.size());
+    std::nth_element(data.begin(), q, data.end());
+    return *q;
   }
 
 
@@ -65,11 +64,9 @@ class Data {
 
   friend Data &operator<<(Data &d, double x) {
     d.data.push_back(x);
-    d.sorted = false;
     return d;
   }
 
-  bool sorted;
   private:
 };
 
@@ -0,0 +1,159 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/************************************************************
+Support for simulating delayed feedback.
+
+A Delay is a distribution over the number of rounds between
+a pull and the arrival of its reward. A reward with delay d
+from a pull in round t becomes visible in round t + 1 + d, so
+a zero delay is the usual immediate-feedback setting.
+
+DelayQueue is a calendar queue (timing wheel) keyed by
+arrival round. Rounds advance one at a time, so each bucket
+holds exactly one round and push/pop are O(1). The wheel
+doubles when an event lands further ahead than its width,
+which keeps the amortised cost per event O(1).
+************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <random>
+#include <utility>
+
+
+/*********************************************************
+* inherit from this class to define a new delay model
+*********************************************************/
+class Delay {
+  public:
+  /* returns the number of rounds before the reward arrives */
+  virtual uint64_t sample() = 0;
+  virtual ~Delay() {
+  }
+};
+
+class FixedDelay : public Delay {
+  public:
+  FixedDelay(uint64_t d) : d(d) {
+  }
+
+  uint64_t sample() {
+    return d;
+  }
+
+  private:
+  uint64_t d;
+};
+
+class UniformDelay : public Delay {
+  public:
+  UniformDelay(uint64_t lo, uint64_t hi, std::default_random_engine &gen) : gen(gen), dist(lo, hi) {
+  }
+
+  uint64_t sample() {
+    return dist(gen);
+  }
+
+  private:
+  std::default_random_engine &gen;
+  std::uniform_int_distribution<uint64_t> dist;
+};
+
+/* geometric delay with the given mean, heavy use of these gives a wide spread of arrival times */
+class GeometricDelay : public Delay {
+  public:
+  GeometricDelay(double mean, std::default_random_engine &gen) : gen(gen), dist(1.0 / (1.0 + mean)) {
+  }
+
+  uint64_t sample() {
+    return dist(gen);
+  }
+
+  private:
+  std::default_random_engine &gen;
+  std::geometric_distribution<uint64_t> dist;
+};
+
+
+template<class T> class DelayQueue {
+  public:
+  DelayQueue() : buckets(64), now(0), count(0) {
+  }
+
+  /* empties the queue and restarts the clock at round t */
+  void reset(uint64_t t = 0) {
+    for (auto &b : buckets) {
+      b.clear();
+    }
+    now = t;
+    count = 0;
+  }
+
+  /* schedule e to arrive in round `when` */
+  void push(uint64_t when, const T &e) {
+    assert(when >= now);
+    if (when - now >= buckets.size()) {
+      grow(when - now + 1);
+    }
+    buckets[when & (buckets.size() - 1)].push_back(std::make_pair(when, e));
+    ++count;
+  }
+
+  /* calls f on every event arriving in round t and advances the clock past t.
+  rounds must be visited in increasing order */
+  template<class F> void pop(uint64_t t, F f) {
+    assert(t >= now);
+    if (count != 0) {
+      for (;now <= t;++now) {
+        auto &b = buckets[now & (buckets.size() - 1)];
+        for (auto &e : b) {
+          f(e.second);
+        }
+        count -= b.size();
+        b.clear();
+        if (count == 0) {
+          break;
+        }
+      }
+    }
+    now = t + 1;
+  }
+
+  uint64_t size()const {
+    return count;
+  }
+
+  private:
+  /* double the width until `width` rounds fit and rehash, each event moves O(1) times on average */
+  void grow(uint64_t width) {
+    uint64_t s = buckets.size();
+    while (s < width) {
+      s *= 2;
+    }
+    std::vector<std::vector<std::pair<uint64_t, T>>> next(s);
+    for (auto &b : buckets) {
+      for (auto &e : b) {
+        next[e.first & (s - 1)].push_back(e);
+      }
+    }
+    buckets.swap(next);
+  }
+
+  std::vector<std::vector<std::pair<uint64_t, T>>> buckets;
+  uint64_t now;
+  uint64_t count;
+};
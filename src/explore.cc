@@ -0,0 +1,109 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all 
+copyright and related and neighboring rights to this software to the 
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication 
+along with this software. If not, 
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+#include "explore.h"
+#include "bandit.h"
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+/*************************************************************
+GENERIC PURE EXPLORATION DRIVER
+*************************************************************/
+Identification PureExploration::identify(BanditProblem &bp, double delta, uint64_t max_rounds) {
+  K = bp.K;
+  assert(max_rounds >= K);
+
+  bp.reset();
+  N.assign(K, 0);
+  S.assign(K, 0.0);
+  Z.reset(K);
+  C.reset(K);
+
+  uint64_t t = 0;
+  for (;t != K;++t) {
+    N[t] = 1;
+    S[t] = bp.choose(t);
+  }
+  rebuild();
+
+  for (;t != max_rounds;++t) {
+    /* GLR stopping rule with threshold log((1 + log t) / delta) */
+    if (Z.min() > log((1.0 + log((double)t)) / delta)) {
+      break;
+    }
+    int i = choose(t);
+    observe(i, bp.choose(i));
+  }
+
+  Identification result;
+  result.tau = t;
+  result.arm = leader;
+  result.correct = (bp.gap(leader) == 0.0);
+  return result;
+}
+
+double PureExploration::glr(int b)const {
+  double d = mean(leader) - mean(b);
+  if (d <= 0.0) {
+    return 0.0;
+  }
+  return d * d / (2.0 / N[leader] + 2.0 / N[b]);
+}
+
+/* recompute the leader and all of its pairwise statistics in O(K) */
+void PureExploration::rebuild() {
+  leader = 0;
+  for (uint64_t i = 1;i != K;++i) {
+    if (mean(i) > mean(leader)) {
+      leader = i;
+    }
+  }
+  keys.resize(K);
+  for (uint64_t b = 0;b != K;++b) {
+    keys[b] = glr(b);
+  }
+  keys[leader] = numeric_limits<double>::infinity();
+  Z.build(keys);
+  for (uint64_t b = 0;b != K;++b) {
+    keys[b]+=log((double)N[b]);
+  }
+  C.build(keys);
+}
+
+/* only Z(leader, i) depends on arm i unless i is or becomes the leader */
+void PureExploration::observe(int i, double r) {
+  N[i]++;
+  S[i]+=r;
+  if (i == leader || mean(i) > mean(leader)) {
+    rebuild();
+  }else {
+    double z = glr(i);
+    Z.update(i, z);
+    C.update(i, z + log((double)N[i]));
+  }
+}
+
+
+int RoundRobin::choose(uint64_t t) {
+  return t % K;
+}
+
+int TopTwo::choose(uint64_t t) {
+  if (dist(gen)) {
+    return leader;
+  }
+  return C.top();
+}
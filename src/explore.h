@@ -0,0 +1,182 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/************************************************************
+Fixed-confidence best-arm identification (pure exploration).
+
+An algorithm samples arms until the GLR stopping rule for
+Gaussian rewards with unit variance fires, then recommends the
+empirical best arm. The statistic is
+
+  Z(t) = min_{b != l} (mu_l - mu_b)^2 / (2/N_l + 2/N_b)
+
+where l is the empirical leader. It is kept in an indexed heap
+so that pulling a non-leader only updates its own term. A second
+heap keyed by Z(l, b) + log N_b gives the transportation-cost
+challenger used by the top-two sampling rule.
+************************************************************/
+#pragma once
+
+#include "bandit.h"
+
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+
+/* the outcome of one run of a pure exploration algorithm */
+class Identification {
+  public:
+  /* number of samples taken before stopping */
+  uint64_t tau;
+  /* the recommended arm */
+  int arm;
+  /* true if the recommended arm is optimal */
+  bool correct;
+};
+
+
+/*************************************************************
+* binary min-heap over 0..K-1 supporting changes of key
+*************************************************************/
+class IndexedHeap {
+  public:
+  void reset(int K) {
+    key.assign(K, 0.0);
+    heap.resize(K);
+    pos.resize(K);
+    for (int i = 0;i != K;++i) {
+      heap[i] = i;
+      pos[i] = i;
+    }
+  }
+
+  /* set all keys at once in O(K) */
+  void build(const std::vector<double> &keys) {
+    key = keys;
+    for (int i = (int)heap.size() / 2 - 1;i >= 0;--i) {
+      down(i);
+    }
+  }
+
+  void update(int i, double k) {
+    double old = key[i];
+    key[i] = k;
+    if (k < old) {
+      up(pos[i]);
+    }else {
+      down(pos[i]);
+    }
+  }
+
+  int top()const {
+    return heap[0];
+  }
+
+  double min()const {
+    return key[heap[0]];
+  }
+
+  private:
+  void swap(int a, int b) {
+    std::swap(heap[a], heap[b]);
+    pos[heap[a]] = a;
+    pos[heap[b]] = b;
+  }
+
+  void up(int i) {
+    while (i > 0 && key[heap[(i - 1) / 2]] > key[heap[i]]) {
+      swap(i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+  }
+
+  void down(int i) {
+    int s = heap.size();
+    while (true) {
+      int l = 2 * i + 1;
+      int m = i;
+      if (l < s && key[heap[l]] < key[heap[m]]) {
+        m = l;
+      }
+      if (l + 1 < s && key[heap[l + 1]] < key[heap[m]]) {
+        m = l + 1;
+      }
+      if (m == i) {
+        return;
+      }
+      swap(i, m);
+      i = m;
+    }
+  }
+
+  std::vector<double> key;
+  std::vector<int> heap;
+  std::vector<int> pos;
+};
+
+
+class PureExploration {
+  public:
+  /* sample until the GLR test at confidence 1 - delta passes or max_rounds samples are taken */
+  Identification identify(BanditProblem &bp, double delta, uint64_t max_rounds);
+
+  protected:
+  /* the sampling rule, returns the arm to sample in round t */
+  virtual int choose(uint64_t t) = 0;
+
+  double mean(int i)const {
+    return S[i] / N[i];
+  }
+
+  /* GLR statistic for "leader is better than b" */
+  double glr(int b)const;
+
+  uint64_t K;
+  std::vector<uint64_t> N;
+  std::vector<double> S;
+
+  /* empirical best arm */
+  int leader;
+  /* Z(leader, b) for every b, the leader itself has key infinity */
+  IndexedHeap Z;
+  /* Z(leader, b) + log N_b, the penalty stops the challenger from starving an arm */
+  IndexedHeap C;
+
+  private:
+  void rebuild();
+  void observe(int i, double r);
+
+  std::vector<double> keys;
+};
+
+
+/* uniform allocation */
+class RoundRobin : public PureExploration {
+  int choose(uint64_t t);
+};
+
+/* samples the leader with probability beta and otherwise the challenger minimising the
+penalised GLR statistic (EB-TCI style top-two) */
+class TopTwo : public PureExploration {
+  public:
+  TopTwo(double beta, std::default_random_engine &gen) : gen(gen), dist(beta) {
+  }
+
+  private:
+  int choose(uint64_t t);
+  std::default_random_engine &gen;
+  std::bernoulli_distribution dist;
+};
@@ -29,6 +29,7 @@ Rewards are Gaussian with given means and unit variance.
 #include <iostream>
 
 #include "bandit.h"
+#include "trajectory.h"
 
 
 class GaussianBandit : public BanditProblem {
@@ -58,19 +59,20 @@ class GaussianBandit : public BanditProblem {
   std::vector<double> means;
 };
 
+/* records the arms pulled and, if asked, the rewards in trajectory, see trajectory.h */
 class GaussianBanditWithLogging : public BanditProblem {
   public:
-  GaussianBanditWithLogging(std::vector<double> means, std::default_random_engine &g) : gen(g) {
+  GaussianBanditWithLogging(std::vector<double> means, std::default_random_engine &g, bool rewards = false,
+                            std::string spill = "") : trajectory(rewards, spill), gen(g) {
     this->K = means.size();
     this->means = means;
     setup();
   }
 
   double sample(int i) {
-    actions.push_back(i);
     std::normal_distribution<double> dist(means[i], 1.0);
     double reward = dist(gen);
-    rewards.push_back(mean(i));
+    trajectory.record(i, reward);
     return reward;
   }
 
@@ -79,13 +81,11 @@ class GaussianBanditWithLogging : public BanditProblem {
   }
 
   void reset() {
-    actions.clear();
-    rewards.clear();
+    trajectory.clear();
     set_regret(0.0);
   }
 
-  std::vector<int> actions;
-  std::vector<double> rewards;
+  Trajectory trajectory;
 
   private:
   std::default_random_engine &gen;
@@ -0,0 +1,293 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all 
+copyright and related and neighboring rights to this software to the 
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication 
+along with this software. If not, 
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+#include "gittins.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#define MAX_IDX 5
+
+using namespace std;
+
+/* This finds the root of the new spline from the old. f(u) = u + gamma * E[prev(u + N(0, var))] is increasing
+and convex with slope 1 + gamma * E[prev'(u + N(0, var))] >= 1, so Newton's method started right of the root
+decreases monotonically to it. Steps leaving the bracket fall back to bisection */
+double FindRoot(const Spline &prev, double var, double tolerance, double gamma) {
+  double l = -MAX_IDX;
+  double u = prev.L;
+  double x = u;
+  while (u - l > tolerance) {
+    double slope;
+    double y = x + gamma * prev.IntegrateSlope(x, var, slope);
+    if (y <= 0) {
+      l = x;
+    }else {
+      u = x;
+    }
+    double next = x - y / (1.0 + gamma * slope);
+    if (!(next > l && next < u)) {
+      next = (u + l) / 2;
+    }
+    /* once the steps are this small the error is far below the tolerance */
+    if (abs(next - x) < 0.25 * tolerance) {
+      return next;
+    }
+    x = next;
+  }
+  return (u + l) / 2.0;
+}
+
+/* compute bellman backup */
+void Backup(const Spline &prev, Spline &next, double var, double tolerance, double gamma, bool warm) {
+
+  /* find the gittins index, which is the root of the integral of the splines in prev */
+  double left = FindRoot(prev, var, tolerance, gamma);
+
+  /* find an estimate of where it is safe to start the right asymptote */
+  double right = 1.0;
+
+  while (abs(gamma * (right * prev.a - prev.Integrate(right, var))) > tolerance) {
+    right *= 2;
+  }
+  next.R = right;
+  next.a = 1.0 + gamma * prev.a;
+
+  auto g = [&prev, var, gamma](const double *x, double *y) {
+    prev.Integrate(x, y, 2, var);
+    y[0] = x[0] + gamma * y[0];
+    y[1] = x[1] + gamma * y[1];
+  };
+
+  if (!warm || prev.size() == 0) {
+    /* create the first quadratice spline on the interval [left,right] and matching [left,(left+right)/2,right] */
+    double middle = (left + right) / 2.0;
+    double ends[2] = {left, middle};
+    double y[2];
+    prev.Integrate(ends, y, 2, var);
+    Quadratic first(left, left + gamma * y[0], middle, middle + gamma * y[1], right, right * next.a);
+
+    /* split pieces until the error is below the tolerance */
+    Refine(next, first, tolerance, g);
+  }else {
+    /* start from every fourth breakpoint of prev, so that neighbouring pieces merge where the error allows */
+    vector<double> x;
+    x.push_back(left);
+    size_t k = 0;
+    for (double b : prev.X) {
+      if (b > left && b < right && (k++ & 3) == 3) {
+        x.push_back(b);
+      }
+    }
+    x.push_back(right);
+
+    /* the values at the breakpoints followed by the midpoints */
+    size_t pieces = x.size() - 1;
+    for (size_t i = 0;i != pieces;++i) {
+      x.push_back((x[i] + x[i + 1]) * 0.5);
+    }
+    vector<double> y(x.size());
+    prev.Integrate(x.data(), y.data(), x.size(), var);
+    for (size_t i = 0;i != x.size();++i) {
+      y[i] = x[i] + gamma * y[i];
+    }
+    y[pieces] = right * next.a;
+
+    for (size_t i = 0;i != pieces;++i) {
+      Refine(next, Quadratic(x[i], y[i], x[pieces + 1 + i], y[pieces + 1 + i], x[i + 1], y[i + 1]), tolerance, g);
+    }
+  }
+  next.L = next.X[0];
+}
+
+
+/*************************************************************
+DISCOUNTED INDICES
+*************************************************************/
+void ComputeDiscounted(double gamma, uint64_t Tmax, uint64_t depth, double tolerance, vector<double> &idx) {
+  /* with no more learning the value is max(0, u) / (1 - gamma) */
+  Spline first;
+  first.L = 0.0;
+  first.a = 1.0 / (1.0 - gamma);
+  first.R = 0.0;
+
+  idx.assign(Tmax, 0.0);
+
+  /* the value function at a level only depends on the number of observations, so one sweep gives
+  the index at every level */
+  for (uint64_t T = Tmax + depth - 1;T != 0;--T) {
+    Spline next;
+    double var = 1.0 / (T * (T + 1.0));
+    Backup(first, next, var, tolerance, gamma);
+    if (T <= Tmax) {
+      idx[T - 1] = -next.L;
+    }
+    first = next;
+  }
+}
+
+
+/*************************************************************
+BERNOULLI / BETA PRIOR
+*************************************************************/
+double BernoulliIndex(uint64_t m, uint64_t s, uint64_t f, double alpha, double beta, double tolerance,
+                      double lower, vector<double> &work) {
+  double p0 = (s + alpha) / (s + f + alpha + beta);
+  if (m == 1) {
+    return p0;
+  }
+  /* V holds the value and D the expected number of retirement rounds (the derivative of V in lambda)
+  of the states (s + i, f + d - i) at depth d */
+  work.resize(2 * (m + 1));
+  double *V = work.data();
+  double *D = V + m + 1;
+
+  double lambda = max(lower, p0);
+  for (int iter = 0;iter != 100;++iter) {
+    for (uint64_t i = 0;i <= m;++i) {
+      V[i] = 0.0;
+      D[i] = 0.0;
+    }
+    for (uint64_t d = m - 1;d != 0;--d) {
+      double k = m - d;
+      double retire = k * lambda;
+      double ia = 1.0 / (s + f + d + alpha + beta);
+      for (uint64_t i = 0;i <= d;++i) {
+        double p = (s + i + alpha) * ia;
+        double cont = p * (1.0 + V[i + 1]) + (1.0 - p) * V[i];
+        if (retire >= cont) {
+          V[i] = retire;
+          D[i] = k;
+        }else {
+          V[i] = cont;
+          D[i] = p * D[i + 1] + (1.0 - p) * D[i];
+        }
+      }
+    }
+    /* g is convex, decreasing and piecewise linear in lambda, so Newton's method started below the root
+    increases monotonically and terminates */
+    double g = p0 * (1.0 + V[1]) + (1.0 - p0) * V[0] - m * lambda;
+    double dg = p0 * D[1] + (1.0 - p0) * D[0] - m;
+    double step = -g / dg;
+    lambda+=step;
+    if (step < tolerance) {
+      break;
+    }
+  }
+  return lambda;
+}
+
+
+double GittinsApprox(uint64_t m, uint64_t T) {
+  double beta = max(1.0, min(m / pow(log(m), 1.5) / 4.0, m / 4.0 / T / pow(log(m/T), 0.5)));
+  return sqrt(2.0 / T * log(beta));
+}
+
+
+/*************************************************************
+CACHE OF COMPUTED DIAGONALS
+*************************************************************/
+GittinsCache::Diagonal GittinsCache::get(uint64_t d) {
+  unique_lock<mutex> guard(lock);
+  auto e = entries.find(d);
+  if (e != entries.end()) {
+    e->second.used = ++clock;
+    shared_future<Diagonal> f = e->second.value;
+    /* do not hold the lock while another thread may still be computing */
+    guard.unlock();
+    return f.get();
+  }
+
+  /* claim the diagonal so that other threads wait for this computation */
+  promise<Diagonal> p;
+  Entry &entry = entries[d];
+  entry.value = p.get_future().share();
+  entry.used = ++clock;
+  entry.size = 0;
+  guard.unlock();
+
+  auto idx = make_shared<vector<double>>(d, 0.0);
+  ComputeDiagonal(d - 1, 1, tolerance, [&idx](uint64_t m, uint64_t T, double v) {
+    (*idx)[m] = v;
+  });
+  p.set_value(idx);
+
+  guard.lock();
+  record(d, *idx);
+  auto mine = entries.find(d);
+  if (mine != entries.end()) {
+    mine->second.size = d;
+    stored+=d;
+  }
+  evict();
+  return idx;
+}
+
+/* drop the least recently used diagonals until the cache fits, never a diagonal still being computed */
+void GittinsCache::evict() {
+  while (stored > capacity) {
+    auto victim = entries.end();
+    for (auto e = entries.begin();e != entries.end();++e) {
+      if (e->second.size != 0 && (victim == entries.end() || e->second.used < victim->second.used)) {
+        victim = e;
+      }
+    }
+    if (victim == entries.end()) {
+      return;
+    }
+    stored-=victim->second.size;
+    entries.erase(victim);
+  }
+}
+
+static pair<int,int> Block(uint64_t m, uint64_t T) {
+  int i = 0, j = 0;
+  while ((m >> (i + 1)) != 0) {
+    ++i;
+  }
+  while ((T >> (j + 1)) != 0) {
+    ++j;
+  }
+  return make_pair(i, j);
+}
+
+/* updates the approximation error of each block crossed by diagonal d */
+void GittinsCache::record(uint64_t d, const vector<double> &idx) {
+  if (approx_tolerance <= 0.0) {
+    return;
+  }
+  for (uint64_t m = 2;m < d;++m) {
+    Error &err = errors[Block(m, d - m)];
+    err.max = max(err.max, abs(GittinsApprox(m, d - m) - idx[m]));
+    err.count++;
+  }
+}
+
+bool GittinsCache::approximate(uint64_t m, uint64_t T) {
+  if (approx_tolerance <= 0.0 || m < 2) {
+    return false;
+  }
+  lock_guard<mutex> guard(lock);
+  auto err = errors.find(Block(m, T));
+  /* require a few diagonals worth of evidence before trusting a block */
+  return err != errors.end() && err->second.count >= 64 && err->second.max <= approx_tolerance;
+}
+
+shared_ptr<GittinsCache> GittinsCache::shared() {
+  /* 2^24 indices is 128MB, the tolerance matches the distributed tables. The approximation is off, so every index
+  is within that tolerance */
+  static shared_ptr<GittinsCache> cache = make_shared<GittinsCache>(1 << 24, 0.000005, 0.0);
+  return cache;
+}
@@ -0,0 +1,146 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all 
+copyright and related and neighboring rights to this software to the 
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication 
+along with this software. If not, 
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/**************************************************************************
+Computation of finite-horizon Gittins indices for the Gaussian prior/noise
+model by backward induction on piecewise quadratic value functions. Used by
+makegittins to build tables and by GaussianGittins to compute indices that
+are not in its table.
+**************************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <vector>
+
+#include "spline.h"
+
+/* This finds the root of the new spline from the old */
+double FindRoot(const Spline &prev, double var, double tolerance, double gamma = 1.0);
+
+/* compute bellman backup, next(u) = max(0, u + gamma * E[prev(u + N(0, var))]). The slope of the
+right asymptote is 1 + gamma * prev.a, which is the number of remaining rounds when gamma = 1. With warm
+the refinement starts from a coarsened copy of the breakpoints of prev instead of a single piece */
+void Backup(const Spline &prev, Spline &next, double var, double tolerance, double gamma = 1.0, bool warm = false);
+
+/* computes the indices along a diagonal by backward induction, calling f(m, Tm, index) for the
+pairs (m, Tm) = (m, T + n - m) with m = 2..n. Returns the number of quadratic pieces used at the last level */
+template<class F> size_t ComputeDiagonal(uint64_t n, uint64_t T, double tolerance, F f, bool warm = false) {
+  /* the first value function is just the hinge function */ 
+  Spline first;
+  first.L = 0.0;
+  first.a = 1.0;
+  first.R = 0.0;
+
+  size_t pieces = 0;
+
+  /* iterate starting from the end and backup the value function and push the index */
+  for (uint64_t t = 2; t!= n+1;++t) {
+    Spline next;
+
+    /* compute the inverse variance of the posterior */
+    uint64_t Tn = (T + n - t);
+
+    /* compute the variance at this level */
+    double var = 1.0 / (Tn * (Tn+1));
+
+    /* backup */
+    Backup(first, next, var, tolerance, 1.0, warm);
+
+    f(t, Tn, -next.L);
+    pieces = next.size();
+    first = next;
+  }
+  return pieces;
+}
+
+/* computes the discounted Gittins indices for T = 1..Tmax observations with a single backward sweep.
+The sweep starts from a hinge at level Tmax + depth, where further learning is ignored. idx[T - 1]
+receives the index for T */
+void ComputeDiscounted(double gamma, uint64_t Tmax, uint64_t depth, double tolerance, std::vector<double> &idx);
+
+/* the finite-horizon Gittins index of a Bernoulli arm with a Beta(alpha, beta) prior after s successes
+and f failures with m rounds remaining. Computed by calibration: Newton's method on the retirement value
+lambda, where each step is a backward induction over the O(m^2) states reachable from (s, f). `lower`
+must be a lower bound on the index, for example the index with m - 1 rounds remaining */
+double BernoulliIndex(uint64_t m, uint64_t s, uint64_t f, double alpha, double beta, double tolerance,
+                      double lower, std::vector<double> &work);
+
+/* the approximation of the index used by GaussianGittinsApprox */
+double GittinsApprox(uint64_t m, uint64_t T);
+
+
+/**************************************************************************
+A bounded cache of computed diagonals shared between threads. Diagonal d
+holds the indices of (m, d - m) for m = 1..d-1. Concurrent requests for the
+same diagonal wait for a single computation.
+
+The cache also records, for blocks (log2 m, log2 T), the largest error of
+GittinsApprox seen on computed diagonals. Where that error is below
+approx_tolerance the approximation is used instead of computing. The
+error is only the largest one sampled, not a bound, so this is off
+unless a cache is created with approx_tolerance > 0. The shared cache
+leaves it off.
+**************************************************************************/
+class GittinsCache {
+  public:
+  typedef std::shared_ptr<const std::vector<double>> Diagonal;
+
+  /* capacity is the maximum number of stored indices, approx_tolerance = 0 disables the approximation */
+  GittinsCache(uint64_t capacity, double tolerance, double approx_tolerance) 
+    : capacity(capacity), tolerance(tolerance), approx_tolerance(approx_tolerance), stored(0), clock(0) {
+  }
+
+  /* returns diagonal d, computing it if necessary */
+  Diagonal get(uint64_t d);
+
+  /* true if GittinsApprox is known to be accurate near (m, T) */
+  bool approximate(uint64_t m, uint64_t T);
+
+  /* a process-wide cache used by default */
+  static std::shared_ptr<GittinsCache> shared();
+
+  const uint64_t capacity;
+  const double tolerance;
+  const double approx_tolerance;
+
+  private:
+  class Entry {
+    public:
+    std::shared_future<Diagonal> value;
+    uint64_t used;
+    uint64_t size;
+  };
+
+  class Error {
+    public:
+    Error() : max(0.0), count(0) {
+    }
+    double max;
+    uint64_t count;
+  };
+
+  void record(uint64_t d, const std::vector<double> &idx);
+  void evict();
+
+  std::mutex lock;
+  std::map<uint64_t, Entry> entries;
+  std::map<std::pair<int,int>, Error> errors;
+  uint64_t stored;
+  uint64_t clock;
+};
@@ -20,82 +20,555 @@ see http://creativecommons.org/publicdomain/zero/1.0/
 #include <fstream>
 #include <stdexcept>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <iostream>
 #include <cassert>
+#include <memory>
+#include <mutex>
+/* for mmap */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-class BayesTable {
+/*************************************************************
+Table files start with a TableHeader and the indices follow at
+TABLE_PAYLOAD_OFFSET, so the payload is page aligned. Files are
+memory mapped read-only and every table opened from the same
+file in a process shares one mapping. Other processes share
+the same pages through the page cache.
+
+Files without a header (the original format of the finite-
+horizon tables) are still accepted by GittinsTable. Version 2
+changed the layout of compressed tables, other kinds are the
+same in both versions.
+*************************************************************/
+class TableHeader {
   public:
-  BayesTable(std::string fn) {
-    std::ifstream in(fn, std::ios::in|std::ios::binary|std::ios::ate);
-    assert(in);
-    std::streamsize s = in.tellg();
-    in.seekg(0, std::ios::beg);
-    n = s / (sizeof(int) * 3 + sizeof(double));
-    for (int i = 0;i != n;++i) {
-      std::vector<int> e = {0,0,0};
-      double d;
-      in.read((char*)e.data(), sizeof(int) * 3);
-      in.read((char*)&d, sizeof(double));
-      data[e] = d;
+  enum Kind : uint32_t {FINITE = 1, DISCOUNTED = 2, BERNOULLI = 3, COMPRESSED = 4, BAYES = 5};
+  enum Element : uint32_t {F64 = 1, F32 = 2, BYTE = 3};
+  /* finite-horizon tables are stored by rows of equal m unless DIAGONAL_MAJOR is set, when each diagonal
+  m + T = d + 1 is contiguous */
+  enum Flags : uint32_t {DIAGONAL_MAJOR = 1};
+
+  char magic[8];
+  uint32_t version;
+  uint32_t kind;
+  uint32_t element;
+  uint32_t flags;
+  uint64_t horizon;
+  /* number of elements in the payload */
+  uint64_t count;
+  double tolerance;
+  /* gamma for discounted tables, alpha and beta for Bernoulli tables */
+  double param[2];
+  uint64_t checksum;
+
+  TableHeader() {
+    memset(this, 0, sizeof(TableHeader));
+    memcpy(magic, "LBGITTIN", 8);
+    version = 2;
+  }
+
+  bool valid()const {
+    return memcmp(magic, "LBGITTIN", 8) == 0;
+  }
+
+  size_t element_size()const {
+    switch (element) {
+      case F32: return sizeof(float);
+      case BYTE: return 1;
     }
-    in.close();
+    return sizeof(double);
   }
-  
-  double lookup(std::vector<int> e) {
-    assert(data.find(e) != data.end());
-    return data[e];
+
+  /* 64-bit FNV-1a over whole words, enough to catch truncation and corruption. Pass the previous
+  hash as h to continue over a further buffer, all but the last must be a multiple of 8 bytes */
+  static uint64_t hash(const void *p, size_t bytes, uint64_t h = 14695981039346656037ULL) {
+    const uint64_t *w = (const uint64_t*)p;
+    for (size_t i = 0;i != bytes / 8;++i) {
+      h = (h ^ w[i]) * 1099511628211ULL;
+    }
+    for (size_t i = bytes / 8 * 8;i != bytes;++i) {
+      h = (h ^ ((const uint8_t*)p)[i]) * 1099511628211ULL;
+    }
+    return h;
+  }
+};
+
+static const size_t TABLE_PAYLOAD_OFFSET = 4096;
+
+/* writes header and payload, filling in the count and checksum */
+inline void WriteTable(std::string fn, TableHeader h, const void *data, uint64_t count) {
+  h.count = count;
+  h.checksum = TableHeader::hash(data, count * h.element_size());
+  std::vector<char> head(TABLE_PAYLOAD_OFFSET, 0);
+  memcpy(head.data(), &h, sizeof(TableHeader));
+  std::ofstream out(fn, std::ios::out | std::ios::binary);
+  assert(out);
+  out.write(head.data(), head.size());
+  out.write((const char*)data, count * h.element_size());
+  out.close();
+}
+
+
+class TableMapping {
+  public:
+  /* returns the process-wide mapping of fn, creating it if necessary */
+  static std::shared_ptr<const TableMapping> open(std::string fn) {
+    static std::mutex lock;
+    static std::map<std::string, std::weak_ptr<const TableMapping>> registry;
+
+    char *real = realpath(fn.c_str(), nullptr);
+    assert(real != nullptr);
+    std::string key(real);
+    free(real);
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto m = registry[key].lock();
+    if (!m) {
+      m = std::shared_ptr<const TableMapping>(new TableMapping(key));
+      registry[key] = m;
+    }
+    return m;
+  }
+
+  /* a private copy in anonymous memory, written by the calling thread so that the kernel places it on that
+  thread's NUMA node */
+  std::shared_ptr<const TableMapping> copy()const {
+    return std::shared_ptr<const TableMapping>(new TableMapping(*this));
+  }
+
+  ~TableMapping() {
+    munmap(base, length);
+  }
+
+  /* header, which is invalid() for headerless files */
+  TableHeader header;
+  /* start and size in bytes of the indices */
+  const void *payload;
+  uint64_t bytes;
+
+  /* recompute the checksum, this touches every page */
+  bool verify()const {
+    return !header.valid() || TableHeader::hash(payload, bytes) == header.checksum;
   }
 
   private:
-  std::map<std::vector<int>,double> data;
-  int n;
+  TableMapping(std::string fn) {
+    int fd = ::open(fn.c_str(), O_RDONLY);
+    assert(fd >= 0);
+    struct stat st;
+    fstat(fd, &st);
+    length = st.st_size;
+    assert(length > 0);
+    base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    assert(base != MAP_FAILED);
+    close(fd);
+
+    /* start reading ahead in the background and ask for huge pages where the kernel supports them
+    for file mappings, failures are harmless */
+#ifdef MADV_HUGEPAGE
+    madvise(base, length, MADV_HUGEPAGE);
+#endif
+    madvise(base, length, MADV_WILLNEED);
+
+    if (length >= TABLE_PAYLOAD_OFFSET && memcmp(base, "LBGITTIN", 8) == 0) {
+      memcpy(&header, base, sizeof(TableHeader));
+      assert(header.version == 1 || header.version == 2);
+      payload = (const char*)base + TABLE_PAYLOAD_OFFSET;
+      bytes = header.count * header.element_size();
+      assert(TABLE_PAYLOAD_OFFSET + bytes <= length);
+    }else {
+      memset(header.magic, 0, 8);
+      payload = base;
+      bytes = length;
+    }
+  }
+
+  TableMapping(const TableMapping &m) : header(m.header), bytes(m.bytes), length(m.length) {
+    base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(base != MAP_FAILED);
+    memcpy(base, m.base, length);
+    payload = (const char*)base + ((const char*)m.payload - (const char*)m.base);
+  }
+
+  void *base;
+  size_t length;
+};
+
+
+/*************************************************************
+Compressed finite-horizon tables. Each row (fixed m) is cut into
+blocks of COMPRESSED_BLOCK consecutive values of T. The indices
+fall off steeply at small T and flatten out later, so a block
+stores a polynomial of degree COMPRESSED_DEGREE in log T, scaled
+to [-1, 1] over the block, plus optional residuals quantised to
+steps of scale and packed in bits bits each. Blocks that cannot
+meet the error bound any other way store doubles. The compressor
+checks every value through eval, so the bound recorded in the
+header is guaranteed.
+*************************************************************/
+static const uint64_t COMPRESSED_BLOCK = 512;
+static const int COMPRESSED_DEGREE = 9;
+
+class CompressedBlock {
+  public:
+  /* values of bits without packed residuals */
+  enum Type : uint32_t {POLYNOMIAL = 0, RAW = 64};
+
+  float c[COMPRESSED_DEGREE + 1];
+  /* u = (log T - center) * width */
+  float center, width;
+  float scale;
+  uint32_t bits;
+  /* offset of the residuals in bytes */
+  uint64_t offset;
+
+  /* the value at position k of the block, whose T has logarithm logT */
+  inline double eval(uint64_t k, double logT, const char *residuals)const {
+    double u = (logT - center) * width;
+    double v = c[COMPRESSED_DEGREE];
+    for (int i = COMPRESSED_DEGREE - 1;i >= 0;--i) {
+      v = v * u + c[i];
+    }
+    if (bits == POLYNOMIAL) {
+      return v;
+    }
+    const char *r = residuals + offset;
+    if (bits == RAW) {
+      double x;
+      memcpy(&x, r + k * sizeof(double), sizeof(x));
+      return x;
+    }
+    /* the residual stream is padded so this load never runs past the end */
+    uint64_t pos = k * bits;
+    uint64_t w;
+    memcpy(&w, r + pos / 8, sizeof(w));
+    int64_t q = (int64_t)((w >> (pos % 8)) & ((1ull << bits) - 1)) - (1ll << (bits - 1));
+    return v + (double)scale * q;
+  }
+
+  /* index of the first block of row r = n - m, rows have r + 1 entries */
+  static uint64_t row_start(uint64_t r) {
+    uint64_t q = r / COMPRESSED_BLOCK;
+    return COMPRESSED_BLOCK * q * (q + 1) / 2 + (r % COMPRESSED_BLOCK) * (q + 1);
+  }
 };
 
+
 class GittinsTable {
   public:
-  GittinsTable(std::string fn) {
-    std::ifstream in(fn, std::ios::in|std::ios::binary|std::ios::ate);
-    assert(in);
-    std::streamsize s = in.tellg();
-    in.seekg(0, std::ios::beg);
-    data = std::vector<double>(s / sizeof(double));
-    in.read((char*)data.data(), s);
-    in.close();
-    n = std::round(0.5*(sqrt(1 + 8 * data.size()) - 1));
+  GittinsTable(std::string fn) : GittinsTable(TableMapping::open(fn)) {
+  }
+
+  GittinsTable(std::shared_ptr<const TableMapping> map) : map(map), blocks(nullptr), residuals(nullptr), diagonal(false) {
+    if (map->header.valid()) {
+      assert(map->header.kind == TableHeader::FINITE || map->header.kind == TableHeader::COMPRESSED);
+      n = map->header.horizon;
+      if (map->header.kind == TableHeader::COMPRESSED) {
+        assert(map->header.version >= 2 && map->header.param[1] == COMPRESSED_BLOCK);
+        blocks = (const CompressedBlock*)map->payload;
+        residuals = (const char*)(blocks + CompressedBlock::row_start(n));
+      }else {
+        assert(map->header.element == TableHeader::F64);
+        diagonal = (map->header.flags & TableHeader::DIAGONAL_MAJOR) != 0;
+      }
+    }else {
+      n = std::round(0.5*(sqrt(1 + 8 * (map->bytes / sizeof(double))) - 1));
+    }
+    data = (const double*)map->payload;
+  }
+
+  GittinsTable(uint64_t h) : owned(h*(h+1)/2, 0.0), blocks(nullptr), residuals(nullptr), diagonal(false), n(h) {
+    data = owned.data();
+  }
+
+  GittinsTable(const GittinsTable &t) : map(t.map), owned(t.owned), blocks(t.blocks), residuals(t.residuals),
+                                       diagonal(t.diagonal), n(t.n) {
+    data = map ? (const double*)map->payload : owned.data();
   }
 
-  GittinsTable(uint64_t h) : data(h*(h+1)/2, 0.0), n(h) {
+  GittinsTable &operator=(const GittinsTable &t) {
+    map = t.map;
+    owned = t.owned;
+    blocks = t.blocks;
+    residuals = t.residuals;
+    diagonal = t.diagonal;
+    n = t.n;
+    data = map ? (const double*)map->payload : owned.data();
+    return *this;
+  }
+
+  /* a copy of the table in memory allocated by the calling thread, see NodeLocal in pool.h */
+  GittinsTable replicate()const {
+    return map ? GittinsTable(map->copy()) : *this;
+  }
+
+  /* true if the index for (m, T) is stored in the table */
+  bool contains(uint64_t m, uint64_t T)const {
+    return m + T <= n + 1;
   }
 
   double get_idx(uint64_t m, uint64_t T)const {
     assert(m >= 1);
     assert(T >= 1);
     assert(m + T <= n + 1);
+    if (blocks != nullptr) {
+      uint64_t k = T - 1;
+      return blocks[CompressedBlock::row_start(n - m) + k / COMPRESSED_BLOCK].eval(k % COMPRESSED_BLOCK,
+                                                                                   log((double)T), residuals);
+    }
+    if (diagonal) {
+      return data[diagonal_start(m + T - 1) + T - 1];
+    }
     uint64_t i = (n - m) * (n - m + 1) / 2 + T - 1;
     return data[i];
   }
 
+  /* position of (m, T) = (d, 1) in a diagonal-major table, the diagonal continues with T = 2..d */
+  static uint64_t diagonal_start(uint64_t d) {
+    return (d - 1) * d / 2;
+  }
+
+  /* only for tables created in memory */
   void set_idx(uint64_t m, uint64_t T, double v) {
     assert(m >= 1);
     assert(T >= 1);
     assert(m + T <= n + 1);
+    assert(!map);
     uint64_t i = (n - m) * (n - m + 1) / 2 + T - 1;
-    data[i] = v;
+    owned[i] = v;
   }
 
-  void write(std::string fn)const {
-    std::ofstream out(fn, std::ios::out | std::ios::binary);
-    assert(out);
-    out.write((char*)data.data(), sizeof(double) * data.size());
-    out.close();
+  void write(std::string fn, double tolerance = 0.0)const {
+    assert(blocks == nullptr);
+    TableHeader h;
+    h.kind = TableHeader::FINITE;
+    h.element = TableHeader::F64;
+    h.horizon = n;
+    h.tolerance = tolerance;
+    WriteTable(fn, h, data, n * (n + 1) / 2);
   }
 
+  uint64_t horizon()const {
+    return n;
+  }
+
+  private:
+  std::shared_ptr<const TableMapping> map;
+  std::vector<double> owned;
+  const double *data;
+  /* set for compressed tables */
+  const CompressedBlock *blocks;
+  const char *residuals;
+  bool diagonal;
+  uint64_t n;
+};
+
+
+/*************************************************************
+Discounted Gittins indices for the Gaussian model. These only
+depend on the number of observations T, so the table is
+one-dimensional, holding the indices for T = 1..n with the
+discount factor in the header. Beyond n the index is extrapolated
+by a power law c T^-p fitted at n/2 and n.
+*************************************************************/
+class DiscountedGittinsTable {
+  public:
+  DiscountedGittinsTable(std::string fn) {
+    auto map = TableMapping::open(fn);
+    assert(map->header.valid());
+    assert(map->header.kind == TableHeader::DISCOUNTED);
+    assert(map->header.element == TableHeader::F64);
+    gamma = map->header.param[0];
+    /* the table is tiny, so copy it rather than hold on to the mapping */
+    const double *p = (const double*)map->payload;
+    data.assign(p, p + map->header.count);
+    fit();
+  }
+
+  DiscountedGittinsTable(double gamma, const std::vector<double> &idx) : gamma(gamma), data(idx) {
+    fit();
+  }
+
+  double get_idx(uint64_t T)const {
+    assert(T >= 1);
+    if (T <= data.size()) {
+      return data[T - 1];
+    }
+    return c * pow((double)T, -p);
+  }
+
+  void write(std::string fn, double tolerance = 0.0)const {
+    TableHeader h;
+    h.kind = TableHeader::DISCOUNTED;
+    h.element = TableHeader::F64;
+    h.horizon = data.size();
+    h.tolerance = tolerance;
+    h.param[0] = gamma;
+    WriteTable(fn, h, data.data(), data.size());
+  }
+
+  double gamma;
+
   private:
+  void fit() {
+    uint64_t n = data.size();
+    assert(n >= 2);
+    double v1 = data[n / 2 - 1];
+    double v2 = data[n - 1];
+    p = log(v1 / v2) / log((double)n / (n / 2));
+    c = v2 * pow((double)n, p);
+  }
+
   std::vector<double> data;
+  double c;
+  double p;
+};
+
+
+/*************************************************************
+Finite-horizon Gittins indices for Bernoulli rewards with a
+Beta prior. The index depends on the remaining horizon m and
+the numbers of successes s and failures f, with s + f <= n - m.
+Entries are floats, stored by r = n - m and then by s + f, so
+the table has n(n+1)(n+2)/6 entries.
+*************************************************************/
+class BernoulliGittinsTable {
+  public:
+  BernoulliGittinsTable(std::string fn) : map(TableMapping::open(fn)) {
+    assert(map->header.valid());
+    assert(map->header.kind == TableHeader::BERNOULLI);
+    assert(map->header.element == TableHeader::F32);
+    n = map->header.horizon;
+    assert(size(n) == map->header.count);
+    data = (const float*)map->payload;
+  }
+
+  BernoulliGittinsTable(uint64_t h) : owned(size(h), 0.0), n(h) {
+    data = owned.data();
+  }
+
+  BernoulliGittinsTable(const BernoulliGittinsTable &t) : map(t.map), owned(t.owned), n(t.n) {
+    data = map ? (const float*)map->payload : owned.data();
+  }
+
+  BernoulliGittinsTable &operator=(const BernoulliGittinsTable &t) {
+    map = t.map;
+    owned = t.owned;
+    n = t.n;
+    data = map ? (const float*)map->payload : owned.data();
+    return *this;
+  }
+
+  static uint64_t size(uint64_t h) {
+    return h * (h + 1) * (h + 2) / 6;
+  }
+
+  double get_idx(uint64_t m, uint64_t s, uint64_t f)const {
+    return data[offset(m, s, f)];
+  }
+
+  /* only for tables created in memory */
+  void set_idx(uint64_t m, uint64_t s, uint64_t f, double v) {
+    assert(!map);
+    owned[offset(m, s, f)] = v;
+  }
+
+  void write(std::string fn, double tolerance, double alpha, double beta)const {
+    TableHeader h;
+    h.kind = TableHeader::BERNOULLI;
+    h.element = TableHeader::F32;
+    h.horizon = n;
+    h.tolerance = tolerance;
+    h.param[0] = alpha;
+    h.param[1] = beta;
+    WriteTable(fn, h, data, size(n));
+  }
+
+  uint64_t horizon()const {
+    return n;
+  }
+
+  private:
+  uint64_t offset(uint64_t m, uint64_t s, uint64_t f)const {
+    assert(m >= 1);
+    assert(m + s + f <= n);
+    uint64_t r = n - m;
+    uint64_t N = s + f;
+    return r * (r + 1) * (r + 2) / 6 + N * (N + 1) / 2 + s;
+  }
+
+  std::shared_ptr<const TableMapping> map;
+  std::vector<float> owned;
+  const float *data;
   uint64_t n;
 };
 
 
+/*************************************************************
+The divide points written by makebayes, the mean of the second
+arm above which it is optimal to sample it. The entry for depth
+m = 1..n and T1 = 1..n - m + 1 (T2 = n + 2 - m - T1) is stored
+by depth and then T1. Files without a header hold records of
+(m, T1, T2) as ints followed by the divide point.
+*************************************************************/
+class BayesTable {
+  public:
+  BayesTable(std::string fn) : map(TableMapping::open(fn)) {
+    if (map->header.valid()) {
+      assert(map->header.kind == TableHeader::BAYES);
+      n = map->header.horizon;
+      data = (const double*)map->payload;
+      return;
+    }
+    const size_t record = sizeof(int) * 3 + sizeof(double);
+    const char *p = (const char*)map->payload;
+    size_t count = map->bytes / record;
+    n = 0;
+    for (size_t i = 0;i != count;++i) {
+      int m;
+      memcpy(&m, p + i * record, sizeof(int));
+      n = std::max(n, (uint64_t)m);
+    }
+    auto flat = std::make_shared<std::vector<double>>(size(n), 0.0);
+    for (size_t i = 0;i != count;++i) {
+      int e[3];
+      double d;
+      memcpy(e, p + i * record, sizeof(e));
+      memcpy(&d, p + i * record + sizeof(e), sizeof(d));
+      (*flat)[offset(n, e[0], e[1])] = d;
+    }
+    owned = flat;
+    data = owned->data();
+  }
+
+  double lookup(std::vector<int> e)const {
+    assert(e.size() == 3);
+    assert(e[0] >= 1 && (uint64_t)e[0] <= n);
+    assert(e[1] >= 1 && (uint64_t)(e[1] + e[2]) == n + 2 - e[0]);
+    return data[offset(n, e[0], e[1])];
+  }
+
+  uint64_t horizon()const {
+    return n;
+  }
+
+  /* position of (m, T1) in a table of depth n */
+  static uint64_t offset(uint64_t n, uint64_t m, uint64_t T1) {
+    return (m - 1) * (2 * n + 2 - m) / 2 + T1 - 1;
+  }
 
+  static uint64_t size(uint64_t n) {
+    return n * (n + 1) / 2;
+  }
 
+  private:
+  std::shared_ptr<const TableMapping> map;
+  std::shared_ptr<const std::vector<double>> owned;
+  const double *data;
+  uint64_t n;
+};
@@ -23,11 +23,28 @@ see http://creativecommons.org/publicdomain/zero/1.0/
 #include <string>
 #include <cerrno>
 #include <random>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cassert>
+#include <csignal>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
 /* yuck, no C++ versions? */
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <signal.h>
 #include <chrono>
 
+#include "coding.h"
+
 
 class LogEntry {
   public:
@@ -41,7 +58,397 @@ class LogEntry {
   }
 };
 
-template<class T> class Logger {
+
+/*************************************************************
+LOG FORMAT
+
+Logs of LogEntry start with a LogFileHeader, followed by one block
+per buffer handed to the writer. Within a block the entries are
+grouped by (id, x) and stored by column:
+
+  LogBlockHeader
+  int32  dictionary[ids]     the distinct ids, sorted
+  uint32 run_id[runs]        position of the id in the dictionary
+  double run_x[runs]
+  uint32 run_count[runs]
+  y values in run order
+
+The y values are XOR coded (see coding.h) when that is smaller
+than storing them as they are. The block header records the id and x ranges,
+so readers can skip blocks without reading them, a checksum of the
+rest of the block and a checksum of the header itself. A header is
+checked before its sizes or ranges are trusted; when one is damaged
+readers look for the next "LBLK" and carry on from there. The order
+of entries within a block is not kept.
+
+Files without the header are arrays of LogEntry as written by
+earlier versions, and are still read.
+*************************************************************/
+class LogFileHeader {
+  public:
+  enum Schema : uint32_t {ID_X_Y = 1};
+
+  char magic[8];
+  uint32_t version;
+  uint32_t schema;
+
+  LogFileHeader() : version(1), schema(ID_X_Y) {
+    memcpy(magic, "LBLOG001", 8);
+  }
+
+  bool valid()const {
+    return memcmp(magic, "LBLOG001", 8) == 0 && version == 1 && schema == ID_X_Y;
+  }
+};
+
+class LogBlockHeader {
+  public:
+  enum Codec : uint32_t {RAW = 0, XOR = 1};
+
+  char magic[4];
+  uint32_t count;
+  uint32_t ids;
+  uint32_t runs;
+  uint32_t codec;
+  uint32_t ybytes;
+  int32_t id_min, id_max;
+  double x_min, x_max;
+  uint64_t checksum;
+  uint64_t header_checksum;
+
+  bool valid()const {
+    return memcmp(magic, "LBLK", 4) == 0 && (codec == RAW || codec == XOR);
+  }
+
+  /* hash of the header with header_checksum zeroed */
+  uint64_t header_hash()const {
+    LogBlockHeader h = *this;
+    h.header_checksum = 0;
+    return hash((const char*)&h, sizeof(h));
+  }
+
+  /* true if the sizes and ranges can be trusted */
+  bool intact()const {
+    return valid() && header_checksum == header_hash();
+  }
+
+  /* bytes following the header */
+  uint64_t payload()const {
+    return (uint64_t)ids * sizeof(int32_t) + (uint64_t)runs * (2 * sizeof(uint32_t) + sizeof(double)) + ybytes;
+  }
+
+  /* FNV-1a over 8-byte words and then the remaining bytes */
+  static uint64_t hash(const char *p, size_t bytes) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t i = 0;
+    for (;i + 8 <= bytes;i+=8) {
+      uint64_t w;
+      memcpy(&w, p + i, 8);
+      h = (h ^ w) * 1099511628211ULL;
+    }
+    for (;i != bytes;++i) {
+      h = (h ^ (uint8_t)p[i]) * 1099511628211ULL;
+    }
+    return h;
+  }
+};
+
+/* chooses the entries a reader wants, by default all of them */
+class LogFilter {
+  public:
+  LogFilter() : x_min(-std::numeric_limits<double>::infinity()), x_max(std::numeric_limits<double>::infinity()) {
+  }
+
+  /* wanted ids, empty for all */
+  std::set<int> ids;
+  double x_min, x_max;
+
+  bool want(int id, double x)const {
+    return (ids.empty() || ids.count(id) != 0) && x >= x_min && x <= x_max;
+  }
+
+  bool want(const LogBlockHeader &h)const {
+    if (h.x_max < x_min || h.x_min > x_max) {
+      return false;
+    }
+    return ids.empty() || ids.lower_bound(h.id_min) != ids.upper_bound(h.id_max);
+  }
+};
+
+
+/* the bytes appended to a log for a buffer of entries, first is true for an empty file. Entries without a
+columnar encoding are written as they are in memory */
+template<class T> void EncodeLog(std::vector<T> &entries, bool first, std::string &out) {
+  out.append((const char*)entries.data(), entries.size() * sizeof(T));
+}
+
+inline void EncodeLog(std::vector<LogEntry> &entries, bool first, std::string &out) {
+  if (first) {
+    LogFileHeader f;
+    out.append((const char*)&f, sizeof(f));
+  }
+  if (entries.empty()) {
+    return;
+  }
+  std::stable_sort(entries.begin(), entries.end(), [](const LogEntry &a, const LogEntry &b) {
+    return a.id < b.id || (a.id == b.id && a.x < b.x);
+  });
+
+  std::vector<int32_t> dictionary;
+  std::vector<uint32_t> run_id, run_count;
+  std::vector<double> run_x;
+  LogBlockHeader h;
+  memcpy(h.magic, "LBLK", 4);
+  h.count = entries.size();
+  h.x_min = h.x_max = entries[0].x;
+  for (size_t i = 0;i != entries.size();++i) {
+    const LogEntry &e = entries[i];
+    if (dictionary.empty() || dictionary.back() != e.id) {
+      dictionary.push_back(e.id);
+    }
+    if (i == 0 || e.id != entries[i - 1].id || e.x != entries[i - 1].x) {
+      run_id.push_back(dictionary.size() - 1);
+      run_x.push_back(e.x);
+      run_count.push_back(0);
+    }
+    run_count.back()++;
+    h.x_min = std::min(h.x_min, e.x);
+    h.x_max = std::max(h.x_max, e.x);
+  }
+  h.ids = dictionary.size();
+  h.runs = run_id.size();
+  h.id_min = dictionary.front();
+  h.id_max = dictionary.back();
+
+  std::string y;
+  uint64_t prev = 0;
+  for (auto &e : entries) {
+    PutXor(e.y, prev, y);
+  }
+  if (y.size() < entries.size() * sizeof(double)) {
+    h.codec = LogBlockHeader::XOR;
+  }else {
+    h.codec = LogBlockHeader::RAW;
+    y.clear();
+    for (auto &e : entries) {
+      y.append((const char*)&e.y, sizeof(double));
+    }
+  }
+  h.ybytes = y.size();
+
+  std::string payload;
+  payload.reserve(h.payload());
+  payload.append((const char*)dictionary.data(), dictionary.size() * sizeof(int32_t));
+  payload.append((const char*)run_id.data(), run_id.size() * sizeof(uint32_t));
+  payload.append((const char*)run_x.data(), run_x.size() * sizeof(double));
+  payload.append((const char*)run_count.data(), run_count.size() * sizeof(uint32_t));
+  payload.append(y);
+  h.checksum = LogBlockHeader::hash(payload.data(), payload.size());
+  h.header_checksum = h.header_hash();
+  out.append((const char*)&h, sizeof(h));
+  out.append(payload);
+}
+
+
+/* decodes the payload of a block, calling f(id, x, y, n) for each wanted run of n values. Returns false if the
+checksum fails */
+template<class F> bool DecodeLogBlock(const LogBlockHeader &h, const char *p, const LogFilter &filter, F f,
+                                      std::vector<double> &y) {
+  if (LogBlockHeader::hash(p, h.payload()) != h.checksum) {
+    return false;
+  }
+  const char *dictionary = p;
+  const char *run_id = dictionary + h.ids * sizeof(int32_t);
+  const char *run_x = run_id + h.runs * sizeof(uint32_t);
+  const char *run_count = run_x + h.runs * sizeof(double);
+  const char *ys = run_count + h.runs * sizeof(uint32_t);
+
+  uint64_t prev = 0;
+  for (uint32_t r = 0;r != h.runs;++r) {
+    uint32_t k, n;
+    int32_t id;
+    double x;
+    memcpy(&k, run_id + r * sizeof(uint32_t), sizeof(k));
+    memcpy(&x, run_x + r * sizeof(double), sizeof(x));
+    memcpy(&n, run_count + r * sizeof(uint32_t), sizeof(n));
+    memcpy(&id, dictionary + k * sizeof(int32_t), sizeof(id));
+    bool want = filter.want(id, x);
+    if (h.codec == LogBlockHeader::RAW) {
+      if (want) {
+        y.resize(n);
+        memcpy(y.data(), ys, n * sizeof(double));
+      }
+      ys+=n * sizeof(double);
+    }else {
+      /* XOR coded values depend on the one before, so skipped runs are still decoded */
+      y.resize(n);
+      for (uint32_t i = 0;i != n;++i) {
+        y[i] = GetXor(prev, [&ys] {
+          return *ys++;
+        });
+      }
+    }
+    if (want) {
+      f(id, x, (const double*)y.data(), (size_t)n);
+    }
+  }
+  return true;
+}
+
+
+/* walks the blocks of a mapped log of size bytes, calling f(offset, header) for each block that is whole.
+Damaged headers are skipped by looking for the next block magic, a block cut short by a crash ends the file */
+template<class F> void ScanLogBlocks(std::string fn, const char *base, uint64_t size, F f) {
+  uint64_t p = sizeof(LogFileHeader);
+  bool lost = false;
+  while (p + sizeof(LogBlockHeader) <= size) {
+    LogBlockHeader h;
+    memcpy(&h, base + p, sizeof(h));
+    if (h.intact()) {
+      uint64_t next = p + sizeof(h) + h.payload();
+      if (next > size) {
+        std::cerr << fn << ": last block is incomplete\n";
+        return;
+      }
+      f(p, h);
+      p = next;
+      lost = false;
+      continue;
+    }
+    if (!lost) {
+      std::cerr << fn << ": bad block header at byte " << p << ", looking for the next block\n";
+      lost = true;
+    }
+    const void *m = memmem(base + p + 1, size - p - 1, "LBLK", 4);
+    if (m == nullptr) {
+      return;
+    }
+    p = (const char*)m - base;
+  }
+}
+
+/* reads a log in either format, calling f(id, x, y, n) for runs of n values with the same id and x. Blocks that
+fail their checksum are reported and skipped */
+template<class F> void ReadLogFile(std::string fn, F f, const LogFilter &filter = LogFilter()) {
+  int fd = open(fn.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  uint64_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return;
+  }
+  void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(m != MAP_FAILED);
+  close(fd);
+  madvise(m, size, MADV_SEQUENTIAL);
+  const char *base = (const char*)m;
+
+  LogFileHeader head;
+  if (size < sizeof(head) || (memcpy(&head, base, sizeof(head)), !head.valid())) {
+    /* raw LogEntry records, ignoring a partial one at the end */
+    for (uint64_t p = 0;p + sizeof(LogEntry) <= size;p+=sizeof(LogEntry)) {
+      LogEntry e;
+      memcpy(&e, base + p, sizeof(e));
+      if (filter.want(e.id, e.x)) {
+        f(e.id, e.x, &e.y, (size_t)1);
+      }
+    }
+  }else {
+    std::vector<double> y;
+    ScanLogBlocks(fn, base, size, [&](uint64_t p, const LogBlockHeader &h) {
+      if (filter.want(h) && !DecodeLogBlock(h, base + p + sizeof(h), filter, f, y)) {
+        std::cerr << fn << ": checksum of a block failed, skipping it\n";
+      }
+    });
+  }
+  munmap(m, size);
+}
+
+/*************************************************************
+A program that calls LogSink::catch_signals() has the Loggers that
+are still alive when it receives SIGINT or SIGTERM flushed before
+it exits as the signal would have made it. The call blocks the
+signals in the calling thread, and so in the threads it starts
+afterwards, and starts a thread that waits for them. Call it at
+the top of main, before starting any threads, and only if the
+program installs no handlers of its own for these signals.
+Without it Loggers leave signal handling alone.
+*************************************************************/
+class LogSink {
+  public:
+  virtual ~LogSink() {
+  }
+
+  /* hands any buffered entries to the writer and waits until they are on disk */
+  virtual void flush() = 0;
+
+  static void catch_signals() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+      sigset_t set;
+      sigemptyset(&set);
+      sigaddset(&set, SIGINT);
+      sigaddset(&set, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &set, nullptr);
+      std::thread([set] {
+        int sig;
+        while (sigwait(&set, &sig) != 0) {
+        }
+        {
+          std::lock_guard<std::mutex> guard(lock());
+          for (auto s : sinks()) {
+            s->flush();
+          }
+        }
+        signal(sig, SIG_DFL);
+        pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+        raise(sig);
+      }).detach();
+    });
+  }
+
+  protected:
+  static void add(LogSink *s) {
+    std::lock_guard<std::mutex> guard(lock());
+    sinks().insert(s);
+  }
+
+  static void remove(LogSink *s) {
+    std::lock_guard<std::mutex> guard(lock());
+    sinks().erase(s);
+  }
+
+  private:
+  static std::mutex &lock() {
+    static std::mutex m;
+    return m;
+  }
+
+  static std::set<LogSink*> &sinks() {
+    static std::set<LogSink*> s;
+    return s;
+  }
+};
+
+
+/*************************************************************
+Each Logger appends to its own shard <filename>.<host>.<pid>.<tid>,
+so concurrent processes and threads never wait for each other. The
+parser reads all shards of a log, see src/parser.cc.
+
+Entries are double buffered. log() appends to data while a
+background thread writes the previous buffer with one large write.
+save() hands data over every 10-20 seconds, or whenever it holds
+capacity entries. If the writer is still busy with the last buffer,
+the caller waits for it, so memory stays bounded when the disk is
+slow. save(true) and the destructor wait until everything is
+written.
+*************************************************************/
+template<class T> class Logger : public LogSink {
   public:
   std::vector<T> data;
   std::string filename;
@@ -50,13 +457,46 @@ template<class T> class Logger {
   std::chrono::time_point<std::chrono::system_clock> last_save;
   std::default_random_engine gen;
 
-  Logger(std::string fn) {
+  /* number of entries at which log() hands the buffer to the writer */
+  size_t capacity;
+
+  Logger(std::string fn, size_t capacity = 1 << 20) : capacity(capacity), busy(false), stop(false), fd(-1) {
     std::random_device rd;
     gen.seed(rd());
     reset_clock();
-    filename = fn;
+    filename = fn + "." + shard_suffix();
+    writer = std::thread([this] {
+      write_loop();
+    });
+    add(this);
+  }
+
+  ~Logger() {
+    remove(this);
+    flush();
+    {
+      std::lock_guard<std::mutex> guard(m);
+      stop = true;
+    }
+    cv.notify_all();
+    writer.join();
+    if (fd >= 0) {
+      close(fd);
+    }
   }
 
+  Logger(const Logger&) = delete;
+  Logger &operator=(const Logger&) = delete;
+
+  /* host, process and thread of the caller */
+  static std::string shard_suffix() {
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0) {
+      host[0] = 0;
+    }
+    host[sizeof(host) - 1] = 0;
+    return std::string(host) + "." + std::to_string(getpid()) + "." + std::to_string(syscall(SYS_gettid));
+  }
 
   void reset_clock() {
     std::uniform_int_distribution<int> dist(10, 20);
@@ -70,48 +510,93 @@ template<class T> class Logger {
     return diff.count();
   }
 
-  void give_lock() {
-    remove(".lock");
-  }
-
-  bool get_lock(bool wait) {
-    int fd = open(".lock", O_WRONLY | O_CREAT | O_EXCL, S_IRWXU);
-    while (fd < 0) {
-      std::cout << "I found a lock file\n";
-      reset_clock();
-      if (!wait) {
-        return false;
-      }
-      sleep(1);
-      std::cout << "sleeping on lock\n";
-      fd = open(".lock", O_WRONLY | O_CREAT | O_EXCL, S_IRWXU);
-    }
-    close(fd);
-    return true;
-  }
-
   void log(T entry) {
+    std::unique_lock<std::mutex> lock(m);
     data.push_back(entry);
+    if (data.size() >= capacity) {
+      submit(lock);
+    }
   }
 
   void save(bool force = true) {
     if (!force && time_since_save() < sleep_time) {
       return;
     }
-    if (!get_lock(force)) {
-      return;
-    }
     std::cout << "saving to " << filename << "\n";
-    std::ofstream out(filename, std::ios::app);
-    for (auto &e : data) {
-      out.write((char*)&e, sizeof(T));
+    if (force) {
+      flush();
+    }else {
+      std::unique_lock<std::mutex> lock(m);
+      submit(lock);
     }
-    out.close();
-    give_lock();
-    data.clear();
     reset_clock();
   }
 
-};
+  void flush() {
+    std::unique_lock<std::mutex> lock(m);
+    submit(lock);
+    cv.wait(lock, [this] {
+      return !busy;
+    });
+  }
 
+  private:
+  /* swaps data with the empty back buffer once the writer has finished with it */
+  void submit(std::unique_lock<std::mutex> &lock) {
+    if (data.empty()) {
+      return;
+    }
+    cv.wait(lock, [this] {
+      return !busy;
+    });
+    data.swap(back);
+    busy = true;
+    cv.notify_all();
+  }
 
+  void write_loop() {
+    std::unique_lock<std::mutex> lock(m);
+    while (true) {
+      cv.wait(lock, [this] {
+        return busy || stop;
+      });
+      if (!busy) {
+        return;
+      }
+      lock.unlock();
+      if (fd < 0) {
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        assert(fd >= 0);
+      }
+      struct stat st;
+      fstat(fd, &st);
+      encoded.clear();
+      EncodeLog(back, st.st_size == 0, encoded);
+      const char *p = encoded.data();
+      size_t left = encoded.size();
+      while (left != 0) {
+        ssize_t w = write(fd, p, left);
+        if (w < 0 && errno == EINTR) {
+          continue;
+        }
+        assert(w > 0);
+        p+=w;
+        left-=w;
+      }
+      back.clear();
+      lock.lock();
+      busy = false;
+      cv.notify_all();
+    }
+  }
+
+  /* the buffer being written and its encoding, only touched by the writer while busy */
+  std::vector<T> back;
+  std::string encoded;
+  bool busy;
+  bool stop;
+  int fd;
+  std::mutex m;
+  std::condition_variable cv;
+  std::thread writer;
+};
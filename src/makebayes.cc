@@ -2,131 +2,40 @@
 #include <string>
 #include <limits>
 #include <cmath>
-#include <list>
-#include <map>
-#include <tuple>
 #include <vector>
-#include <fstream>
 #include <cassert>
 #include <cstring>
 #include <thread>
+#include <atomic>
+#include <functional>
 
 #include "pool.h"
+#include "spline.h"
+#include "gittins_table.h"
 
 using namespace std;
 
-/* stores data for a quadratic spline */
-class Quadratic {
+/* the value function of a state and the point at which the second arm becomes optimal */
+class BayesSpline : public Spline {
   public:
-
-  /* store quadratic as "ax^2 + bx + c" */
-  double a,b,c;
-
-  /* start and end of spline */
-  double L,R;
- 
-  /* book-keeping flag, set to true if the spline has been proven to have sufficient accuracy */
-  bool accurate;
-  
-  /* fit to tuple of points */
-  Quadratic(double x1, double y1, double x2, double y2, double x3, double y3) {
-    L = x1;
-    R = x3;
-    a = ((y2 - y1)*(x1 - x3) + (y3 - y1)*(x2 - x1)) / ((x1-x3)*(x2*x2-x1*x1) + (x2-x1)*(x3*x3-x1*x1));
-    b = ((y2 - y1) - a*(x2*x2 - x1*x1)) / (x2 - x1);
-    c = y1 - a*x1*x1 - b*x1;
-
-    accurate = false;
-  }
-  
-  /* integrate with respect to gaussian with mean u and variance v */
-  double Integrate(double u, double v)const {
-    double t1, t2;
-    double i2v = 0.5 / v;
-    double sqrtv = sqrt(v);
-    // sqrt(1.0 / (2Pi)) = 0.3989422804014327
-    t1 = 0.3989422804014327 * sqrtv * (exp(-(L-u)*(L-u) * i2v) * (b + a*(L+u)) - exp(-(R-u)*(R-u) * i2v) * (b + a*(R+u)));
-    t2 = 0.5 * (c + b*u + a*(u*u + v));
-    // sqrt(0.5) = 0.7071067811865476
-    double i_sqrt2v = 0.7071067811865476 / sqrtv;
-    return t1 + t2*(erf((u - L) * i_sqrt2v) - erf((u - R) * i_sqrt2v));
-  }
-  
-  /* return the value at x */
-  inline double val(double x)const {
-    return a * x * x + b*x + c;
+  BayesSpline() : divide(0.0) {
   }
 
-  /* return value at left */
-  inline double left_val()const {
-    return val(L);
-  }
-  /* return value at right */
-  inline double right_val()const {
-    return val(R);
-  }
-  /* return value at middle */
-  inline double middle_val()const {
-    return val((L + R)/2);
-  }
-};
-
-
-/* a spline for our purposes is a list of piecewise quadratic functions and a linear asymptote for the right
-hand side */
-class Spline : public list<Quadratic> {
-  public:
-  /* stores the start of the linear asymptote */
-  double R;
-  /* stores the gradient */
-  double a;
-  /* stores the root of the spline */
-  double L;
-  /* stores the point at which the second arm becomes optimal */
   double divide;
-
-  /* integrate all functions in the spline with respect to N(u, v) */
-  double Integrate(double u, double v)const {
-    /* this is for the linear asymptote */
-    double sum = a * sqrt(v / (2 * M_PI)) * exp(-pow(R-u,2)/(2*v)) + 0.5*a*u*erfc((R-u)/sqrt(2*v));
-    /* now iterate over quadratic pieces */
-    for (auto q = begin();q!=end();++q) {
-      sum+=q->Integrate(u, v); 
-    }
-    return sum;
-  }
-
-  double Value(double x) {
-    if (x < L) {
-      return 0.0;
-    }
-    if (x > R) {
-      return a * x;
-    }
-
-    for (auto i = begin();i!=end();i++) {
-      if (x >= i->L && x <= i->R) {
-        return i->val(x);
-      }
-    }
-    return 0;
-  }
 };
 
-void ComputeIndex(map<vector<int>,Spline> *lookup, int n, int T1, int T2, double tolerance) {
-  Spline next;
+/* computes the value function at depth n with T1 and T2 observations of the arms into next. prev holds the
+value functions at depth n - 1, indexed by T1 - 1 */
+void ComputeIndex(const BayesSpline *prev, BayesSpline &next, int n, int T1, int T2, double tolerance) {
   if (n == 1) {
     next.R = 0.0;
     next.a = 1.0;
-    (*lookup)[{n, T1, T2}] = next;
     return;
   }
 
-  vector<int> e1 = {n-1,T1+1,T2};
-  vector<int> e2 = {n-1,T1,T2+1};
-
-  Spline V1 = (*lookup)[e1];
-  Spline V2 = (*lookup)[e2];
+  /* the states after sampling the first arm, (T1 + 1, T2), or the second, (T1, T2 + 1) */
+  const Spline &V1 = prev[T1];
+  const Spline &V2 = prev[T1 - 1];
 
 
   double v1 = 1.0 / (T1 * (T1 + 1.0));
@@ -157,47 +66,17 @@ void ComputeIndex(map<vector<int>,Spline> *lookup, int n, int T1, int T2, double
 
   /* create the first quadratice spline on the interval [left,right] and matching [left,(left+right)/2,right] */
   double middle = (left + right) / 2.0;
-  next.push_back(Quadratic(left, 0.0, middle, max(V1.Integrate(middle, v1), middle + V2.Integrate(middle, v2)), right, right * n));
+  Quadratic first(left, 0.0, middle, max(V1.Integrate(middle, v1), middle + V2.Integrate(middle, v2)), right, right * n);
 
-  /* iterate over the splines, adding as the error is larger than the tolerance */
-  auto i = next.begin();
-  while (i != next.end()) {
-    /* if the spline is known to be accurate then do nothing */
-    if (!i->accurate) {
-      /* otherwise calculate the two midpoints */
-      double m = (i->L + i->R) * 0.5;
-      double ml = (i->L + m) * 0.5;
-      double mr = (i->R + m) * 0.5;
- 
-      /* calculate the values at the midpoints */
-      double yl = max(V1.Integrate(ml, v1), ml + V2.Integrate(ml, v2));
-      double yr = max(V1.Integrate(mr, v1), mr + V2.Integrate(mr, v2));
-      
-      /* and the errors with respect to the current spline */
-      double errl = abs(yl - i->val(ml));
-      double errr = abs(yr - i->val(mr));
+  /* split pieces until the error is below the tolerance */
+  Refine(next, first, tolerance, [&V1, &V2, v1, v2](const double *x, double *y) {
+    double y1[2], y2[2];
+    V1.Integrate(x, y1, 2, v1);
+    V2.Integrate(x, y2, 2, v2);
+    y[0] = max(y1[0], x[0] + y2[0]);
+    y[1] = max(y1[1], x[1] + y2[1]);
+  });
 
-      /* if the error is large enough, then split the quadratic into two */
-      if (max(errl,errr) > tolerance) { 
-        /* create two new quadratics to replace the old */
-        Quadratic q1(i->L, i->left_val(), ml, yl, m, i->middle_val()); 
-        Quadratic q2(m, i->middle_val(), mr, yr, i->R, i->right_val());
-        
-        /* if original spline was accurate in one half, then the new one should be too, so
-        we don't need to check next time (saves some integrals) */
-        q1.accurate = (errl < tolerance);
-        q2.accurate = (errr < tolerance);
-        
-        /* erease the old spline and insert the new ones */
-        i = next.erase(i);
-        i = next.insert(i, q2);
-        i = next.insert(i, q1);
-        continue;
-      }
-    }
-    ++i;
-  }
-  
   while (right - left > tolerance) {
     double m = (left + right) / 2.0;
     double vr = m + V2.Integrate(m, v2);
@@ -209,53 +88,76 @@ void ComputeIndex(map<vector<int>,Spline> *lookup, int n, int T1, int T2, double
     }
   }
   next.divide = (left + right) / 2.0;
-
-  (*lookup)[{n,T1,T2}] = next;
 }
 
 
-void BuildTable(string fn, int n, double tolerance, int max_threads) {
-  map<vector<int>,Spline> *lookup = new map<vector<int>,Spline>();
-  for (int m = 1;m!=n+1;m++) {
-    cout << "running at depth " << m << "\n";
-    vector<thread> threads;
-    for (int T1 = 1;T1!=n-m+2;T1++) {
-      int T2 = 2 + n - m - T1;
-      (*lookup)[{m,T1,T2}] = Spline();
-    }
-    for (int i = 0;i != max_threads;++i) {
-      threads.push_back(std::thread([max_threads, i, lookup, m, n, tolerance] {
-        for (int T1 = 1;T1!=n-m+2;T1++) {
-          int T2 = 2 + n - m - T1;
-          if (T1 % max_threads == i) {
-            ComputeIndex(lookup, m, T1, T2, tolerance);
-          }
-        }
-        return 0;
-      })); 
-    }
-    for (int i = 0;i != max_threads;++i) {
-      threads[i].join();
+/* entry (m, T1) needs (m - 1, T1) and (m - 1, T1 + 1), so rather than finishing a depth before starting the
+next, every entry is started as soon as its inputs are done. The value functions are kept in two rows of slots
+chosen by the parity of m. (m, T1) overwrites (m - 2, T1), which is read by (m - 1, T1 - 1) and (m - 1, T1), so
+the former is an extra input. The counters of depths m and m + 2 share a row too; the counter of (m, T1) is
+reset when it starts, before any input of (m + 2, T1) can finish */
+void BuildTable(string fn, int n, double tolerance, int max_threads, const Placement &placement) {
+  vector<BayesSpline> slots[2] = {vector<BayesSpline>(n), vector<BayesSpline>(n)};
+  vector<atomic<int>> waiting[2] = {vector<atomic<int>>(n), vector<atomic<int>>(n)};
+  /* entries left at each depth, depth m finishes after depth m - 1 */
+  vector<atomic<int>> remaining(n + 1);
+  vector<double> divide(BayesTable::size(n), 0.0);
+
+  auto inputs = [](int T1) {
+    return T1 > 1 ? 3 : 2;
+  };
+  for (int T1 = 1;T1 != n + 1;++T1) {
+    waiting[0][T1 - 1] = inputs(T1);
+  }
+  for (int m = 1;m != n + 1;++m) {
+    remaining[m] = n - m + 1;
+  }
+
+  Workers workers(max_threads, placement);
+  function<void(int, int)> run = [&](int m, int T1) {
+    waiting[m % 2][T1 - 1] = inputs(T1);
+    BayesSpline &next = slots[m % 2][T1 - 1];
+    next.clear();
+    ComputeIndex(slots[(m + 1) % 2].data(), next, m, T1, n + 2 - m - T1, tolerance);
+    divide[BayesTable::offset(n, m, T1)] = next.divide;
+
+    if (--remaining[m] == 0) {
+      cout << "finished depth " << m << "\n";
     }
-    if (m > 1) {
-      for (int T1 = 1;T1!=n-(m-1)+1;T1++) {
-        int T2 = 2 + n - (m - 1) - T1;
-        auto L = lookup->find({m-1,T1,T2});
-        L->second.erase(L->second.begin(), L->second.end());
+    /* (m, T1) is an input of (m + 1, T1 - 1), (m + 1, T1) and (m + 1, T1 + 1) */
+    for (int j = max(T1 - 1, 1);j <= min(T1 + 1, n - m);++j) {
+      if (--waiting[(m + 1) % 2][j - 1] == 0) {
+        workers.spawn([&run, m, j] {
+          run(m + 1, j);
+        });
       }
     }
-  }
-  ofstream out(fn, ios::out | ios::binary);
-  for (auto &e : *lookup) {
-    out.write((char*)e.first.data(), sizeof(int) * 3);
-    out.write((char*)&e.second.divide, sizeof(double));
-  }
-  out.close();
+  };
+  for (int T1 = 1;T1 != n + 1;++T1) {
+    workers.spawn([&run, T1] {
+      run(1, T1);
+    });
+  }
+  workers.wait();
+
+  TableHeader h;
+  h.kind = TableHeader::BAYES;
+  h.element = TableHeader::F64;
+  h.horizon = n;
+  h.tolerance = tolerance;
+  WriteTable(fn, h, divide.data(), divide.size());
 }
 
 
 
 int main(int argc, char *argv[]) {
+  /* threads are unpinned unless --cores=list ("all" for every core the process may use) is given */
+  Placement placement;
+  if (argc > 2 && !strncmp(argv[argc - 1], "--cores=", 8)) {
+    placement = Placement(argv[argc - 1] + 8);
+    --argc;
+  }
+
   if (argc <= 1) {
     goto die;
   }
@@ -268,11 +170,11 @@ int main(int argc, char *argv[]) {
     assert(n >= 1);
     assert(tolerance > 0);
 
-    BuildTable(fn, n-2, tolerance, max_threads);
+    BuildTable(fn, n-2, tolerance, max_threads, placement);
     return 0;
   }
 die:
-  cout << "Usage: makebayes build filename horizon tolerance max_threads\n";
+  cout << "Usage: makebayes build filename horizon tolerance max_threads [--cores=list]\n";
   return 0;  
 }
 
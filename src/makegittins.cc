@@ -17,7 +17,6 @@ Code for computing Gittins indices with Gaussian prior/noise model.
 Author: Tor Lattimore, 2015
 **************************************************************************/
 #include <iostream>
-#include <list>
 #include <limits>
 #include <fstream>
 #include <cmath>
@@ -26,217 +25,647 @@ Author: Tor Lattimore, 2015
 #include <cstring>
 #include <cassert>
 #include <random>
+#include <atomic>
 
 #include "pool.h"
+#include "gittins.h"
 #include "gittins_table.h"
 
-#define MAX_IDX 5
-
 using namespace std;
 
-/* stores data for a quadratic spline */
-class Quadratic {
-  public:
+/* where the threads of the builders run, set with --cores */
+Placement placement;
 
-  /* store quadratic as "ax^2 + bx + c" */
-  double a,b,c;
+/* compute the index */
+void ComputeIndex(int n, int T, double tolerance, bool warm) {
+  double last = 0.0;
+  uint64_t integrals = SplineIntegrals();
+  size_t pieces = ComputeDiagonal(n, T, tolerance, [&last](uint64_t t, uint64_t Tn, double idx) {
+    last = idx;
+  }, warm);
+  integrals = SplineIntegrals() - integrals;
+  cout << "index for (" << n << ", " << T << ") is " << last << " based on " << pieces << " splines and "
+       << integrals << " integrals\n";
+}
 
-  /* start and end of spline */
-  double L,R;
- 
-  /* book-keeping flag, set to true if the spline has been proven to have sufficient accuracy */
-  bool accurate;
-  
-  /* fit to tuple of points */
-  Quadratic(double x1, double y1, double x2, double y2, double x3, double y3) {
-    L = x1;
-    R = x3;
-    a = ((y2 - y1)*(x1 - x3) + (y3 - y1)*(x2 - x1)) / ((x1-x3)*(x2*x2-x1*x1) + (x2-x1)*(x3*x3-x1*x1));
-    b = ((y2 - y1) - a*(x2*x2 - x1*x1)) / (x2 - x1);
-    c = y1 - a*x1*x1 - b*x1;
 
-    accurate = false;
+/*************************************************************
+DIAGONAL LOGS
+
+Diagonal t of a table holds the indices of (m, t + 1 - m) for
+m = 2..t and does not depend on the horizon. Builds append each
+finished diagonal to a log as the record
+
+  t, idx[2..t], checksum
+
+after a header recording the tolerance, horizon and shard. A
+build logs to <file>.ckpt, so an interrupted build replays the
+log and only computes the missing diagonals. A shard of a build
+split over several processes is a log of its diagonals, which
+merge assembles into a table. A record torn by a crash fails
+its checksum and is dropped. Streamed builds write the indices
+straight to the table, so their log only records t.
+*************************************************************/
+class DiagonalLog {
+  public:
+  class Head {
+    public:
+    char magic[8];
+    double tolerance;
+    uint64_t horizon;
+    /* diagonals t with t % shards == shard */
+    uint64_t shard;
+    uint64_t shards;
+    uint64_t flags;
+  };
+
+  /* set if records hold the indices */
+  static const uint64_t INDICES = 1;
+
+  /* opens or creates the log. An existing log must have been written with the same tolerance */
+  DiagonalLog(string fn, double tolerance, uint64_t horizon, uint64_t shard = 0, uint64_t shards = 1,
+              uint64_t flags = INDICES) : fn(fn) {
+    fd = open(fn.c_str(), O_RDWR | O_CREAT, 0644);
+    assert(fd >= 0);
+    memset(&head, 0, sizeof(Head));
+    if (pread(fd, &head, sizeof(Head), 0) != sizeof(Head)) {
+      /* a new log */
+      memcpy(head.magic, "LBGCKPT1", 8);
+      head.tolerance = tolerance;
+      head.horizon = horizon;
+      head.shard = shard;
+      head.shards = shards;
+      head.flags = flags;
+      ssize_t r = pwrite(fd, &head, sizeof(Head), 0);
+      assert(r == sizeof(Head));
+    }
+    assert(memcmp(head.magic, "LBGCKPT1", 8) == 0);
+    if (head.tolerance != tolerance) {
+      cout << fn << " was written with tolerance " << head.tolerance << "\n";
+      assert(false);
+    }
+    end = sizeof(Head);
+  }
+
+  /* opens an existing log read-only */
+  DiagonalLog(string fn) : fn(fn) {
+    fd = open(fn.c_str(), O_RDONLY);
+    assert(fd >= 0);
+    ssize_t r = pread(fd, &head, sizeof(Head), 0);
+    assert(r == sizeof(Head) && memcmp(head.magic, "LBGCKPT1", 8) == 0);
+    end = sizeof(Head);
   }
-  
-  /* integrate with respect to gaussian with mean u and variance v */
-  double Integrate(double u, double v)const {
-    double t1, t2;
-    double i2v = 0.5 / v;
-    double sqrtv = sqrt(v);
-    // sqrt(1.0 / (2Pi)) = 0.3989422804014327
-    t1 = 0.3989422804014327 * sqrtv * (exp(-(L-u)*(L-u) * i2v) * (b + a*(L+u)) - exp(-(R-u)*(R-u) * i2v) * (b + a*(R+u)));
-    t2 = 0.5 * (c + b*u + a*(u*u + v));
-    // sqrt(0.5) = 0.7071067811865476
-    double i_sqrt2v = 0.7071067811865476 / sqrtv;
-    return t1 + t2*(erf((u - L) * i_sqrt2v) - erf((u - R) * i_sqrt2v));
+
+  ~DiagonalLog() {
+    close(fd);
   }
-  
-  /* return the value at x */
-  inline double val(double x)const {
-    return a * x * x + b*x + c;
+
+  /* calls f(t, idx) for each complete record and positions the log after the last one. Returns the number of
+  records */
+  template<class F> uint64_t replay(F f) {
+    struct stat st;
+    fstat(fd, &st);
+    uint64_t size = st.st_size;
+
+    uint64_t count = 0;
+    vector<char> record;
+    vector<double> idx;
+    end = sizeof(Head);
+    while (end + sizeof(uint64_t) <= size) {
+      uint64_t t;
+      ssize_t r = pread(fd, &t, sizeof(t), end);
+      size_t bytes = record_size(t);
+      if (r != sizeof(t) || t < 2 || t > head.horizon || end + bytes > size) {
+        break;
+      }
+      record.resize(bytes);
+      r = pread(fd, record.data(), bytes, end);
+      uint64_t checksum;
+      memcpy(&checksum, record.data() + bytes - sizeof(checksum), sizeof(checksum));
+      if (r != (ssize_t)bytes || TableHeader::hash(record.data(), bytes - sizeof(checksum)) != checksum) {
+        break;
+      }
+      idx.clear();
+      if (head.flags & INDICES) {
+        idx.assign(t + 1, 0.0);
+        memcpy(idx.data() + 2, record.data() + sizeof(t), (t - 1) * sizeof(double));
+      }
+      f(t, idx);
+      end+=bytes;
+      ++count;
+    }
+    /* drop a torn record so that appends follow the last good one */
+    if (end != size && (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR) {
+      int r = ftruncate(fd, end);
+      assert(r == 0);
+    }
+    return count;
   }
 
-  /* return value at left */
-  inline double left_val()const {
-    return val(L);
+  /* appends diagonal t with idx[m] the index of (m, t + 1 - m), safe to call from several threads */
+  void append(uint64_t t, const vector<double> &idx) {
+    size_t bytes = record_size(t);
+    vector<char> record(bytes);
+    memcpy(record.data(), &t, sizeof(t));
+    if (head.flags & INDICES) {
+      memcpy(record.data() + sizeof(t), idx.data() + 2, (t - 1) * sizeof(double));
+    }
+    uint64_t checksum = TableHeader::hash(record.data(), bytes - sizeof(checksum));
+    memcpy(record.data() + bytes - sizeof(checksum), &checksum, sizeof(checksum));
+
+    lock_guard<mutex> guard(lock);
+    ssize_t r = pwrite(fd, record.data(), bytes, end);
+    assert(r == (ssize_t)bytes);
+    fdatasync(fd);
+    end+=bytes;
   }
-  /* return value at right */
-  inline double right_val()const {
-    return val(R);
+
+  /* removes the log once the table is written */
+  void remove() {
+    unlink(fn.c_str());
   }
-  /* return value at middle */
-  inline double middle_val()const {
-    return val((L + R)/2);
+
+  Head head;
+
+  private:
+  size_t record_size(uint64_t t)const {
+    return sizeof(uint64_t) + ((head.flags & INDICES) ? (t - 1) * sizeof(double) : 0) + sizeof(uint64_t);
   }
+
+  string fn;
+  int fd;
+  uint64_t end;
+  mutex lock;
 };
 
 
-/* a spline for our purposes is a list of piecewise quadratic functions and a linear asymptote for the right
-hand side */
-class Spline : public list<Quadratic> {
+/* the destination of a build. By default the table is held in memory and written at the end. A streamed
+table is written in diagonal-major order straight to a preallocated file with one pwrite per diagonal, so
+memory does not grow with the table. A streamed file left by an interrupted build is reused */
+class TableOutput {
   public:
-  /* stores the start of the linear asymptote */
-  double R;
-  /* stores the gradient */
-  double a;
-  /* stores the root of the spline */
-  double L;
-
-  /* integrate all functions in the spline with respect to N(u, v) */
-  double Integrate(double u, double v)const {
-    /* this is for the linear asymptote */
-    double sum = a * sqrt(v / (2 * M_PI)) * exp(-pow(R-u,2)/(2*v)) + 0.5*a*u*erfc((R-u)/sqrt(2*v));
-    /* now iterate over quadratic pieces */
-    for (auto q = begin();q!=end();++q) {
-      sum+=q->Integrate(u, v); 
-    }
-    return sum;
+  TableOutput(string fn, uint64_t n, double tolerance, bool stream) : fn(fn), n(n), tolerance(tolerance), fd(-1), kept(false) {
+    if (!stream) {
+      table.reset(new GittinsTable(n));
+      return;
+    }
+    head.kind = TableHeader::FINITE;
+    head.element = TableHeader::F64;
+    head.flags = TableHeader::DIAGONAL_MAJOR;
+    head.horizon = n;
+    head.tolerance = tolerance;
+    head.count = n * (n + 1) / 2;
+
+    fd = open(fn.c_str(), O_RDWR | O_CREAT, 0644);
+    assert(fd >= 0);
+    TableHeader old;
+    kept = pread(fd, &old, sizeof(old), 0) == sizeof(old) && old.valid() && old.kind == head.kind &&
+           old.flags == head.flags && old.horizon == n && old.tolerance == tolerance;
+    if (!kept) {
+      int r = ftruncate(fd, 0);
+      assert(r == 0);
+    }
+    /* the checksum is filled in by finish() */
+    vector<char> page(TABLE_PAYLOAD_OFFSET, 0);
+    memcpy(page.data(), &head, sizeof(head));
+    ssize_t w = pwrite(fd, page.data(), page.size(), 0);
+    assert(w == (ssize_t)page.size());
+    if (posix_fallocate(fd, TABLE_PAYLOAD_OFFSET, head.count * sizeof(double)) != 0) {
+      int r = ftruncate(fd, TABLE_PAYLOAD_OFFSET + head.count * sizeof(double));
+      assert(r == 0);
+    }
+  }
+
+  ~TableOutput() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  /* true if a streamed file from an earlier run with the same parameters was kept */
+  bool resumed()const {
+    return kept;
+  }
+
+  /* stores diagonal t, idx[m] is the index of (m, t + 1 - m) for m = 2..t. Safe to call from several threads */
+  void write(uint64_t t, const vector<double> &idx) {
+    if (table) {
+      for (uint64_t m = 2;m <= t;++m) {
+        table->set_idx(m, t + 1 - m, idx[m]);
+      }
+      return;
+    }
+    /* T = 1..t, the last entry has m = 1 where the index is zero */
+    vector<double> diagonal(t, 0.0);
+    for (uint64_t T = 1;T < t;++T) {
+      diagonal[T - 1] = idx[t + 1 - T];
+    }
+    uint64_t offset = TABLE_PAYLOAD_OFFSET + GittinsTable::diagonal_start(t) * sizeof(double);
+    ssize_t w = pwrite(fd, diagonal.data(), t * sizeof(double), offset);
+    assert(w == (ssize_t)(t * sizeof(double)));
+    /* the data must be on disk before the diagonal is logged as done */
+    fdatasync(fd);
   }
+
+  void finish() {
+    if (table) {
+      table->write(fn, tolerance);
+      return;
+    }
+    /* checksum the payload in chunks */
+    uint64_t bytes = head.count * sizeof(double);
+    uint64_t h = 14695981039346656037ULL;
+    vector<char> chunk(1 << 24);
+    for (uint64_t pos = 0;pos < bytes;pos+=chunk.size()) {
+      size_t len = min((uint64_t)chunk.size(), bytes - pos);
+      ssize_t r = pread(fd, chunk.data(), len, TABLE_PAYLOAD_OFFSET + pos);
+      assert(r == (ssize_t)len);
+      h = TableHeader::hash(chunk.data(), len, h);
+    }
+    head.checksum = h;
+    ssize_t w = pwrite(fd, &head, sizeof(head), 0);
+    assert(w == sizeof(head));
+    fsync(fd);
+  }
+
+  private:
+  string fn;
+  uint64_t n;
+  double tolerance;
+  unique_ptr<GittinsTable> table;
+  TableHeader head;
+  int fd;
+  bool kept;
 };
 
-/* This finds the root of the new spline from the old */
-double FindRoot(const Spline &prev, double var, double tolerance) {
-  double l = -MAX_IDX;
-  double u = prev.L;
-  while (u - l > tolerance) {
-    double m = (u + l) / 2;
-    double y = m + prev.Integrate(m, var);
-    if (y <= 0) {
-      l = m;
-    }else {
-      u = m;
+
+/* computes the diagonals t = 2..n that are not done in a pool, calling finish(t, idx) as each completes.
+Returns the number of integrals */
+template<class F> uint64_t ComputeDiagonals(int n, double tolerance, int max_threads, bool warm, const vector<bool> &done,
+                                            F finish) {
+  Pool<int> pool(max_threads, placement);
+  atomic<uint64_t> integrals(0);
+  for (int t = n;t >= 2;--t) {
+    if (!done[t]) {
+      pool.push([t, tolerance, warm, &finish, &integrals] {
+        vector<double> idx(t + 1, 0.0);
+        uint64_t start = SplineIntegrals();
+        ComputeDiagonal(t, 1, tolerance, [&idx](uint64_t m, uint64_t Tm, double v) {
+          idx[m] = v;
+        }, warm);
+        integrals+=SplineIntegrals() - start;
+        finish(t, idx);
+        return 0;
+      });
     }
   }
-  return (u + l) / 2.0;
+  pool.run();
+  cout << "computed " << integrals << " integrals\n";
+  return integrals;
 }
 
-/* compute bellman backup */
-void Backup(const Spline &prev, Spline &next, int t, double var, double tolerance) {
-
-  /* find the gittins index, which is the root of the integral of the splines in prev */
-  double left = FindRoot(prev, var, tolerance);
-
-  /* find an estimate of where it is safe to start the right asymptote */
-  double right = 1.0;
-
-  while (abs(right * t - right - prev.Integrate(right, var)) > tolerance) {
-    right *= 2;
-  }
-  next.R = right;
-  next.a = t;
-
-  /* create the first quadratice spline on the interval [left,right] and matching [left,(left+right)/2,right] */
-  double middle = (left + right) / 2.0;
-  next.push_back(Quadratic(left, left + prev.Integrate(left, var), middle, middle + prev.Integrate(middle, var), right, right * t));
-
-  /* iterate over the splines, adding as the error is larger than the tolerance */
-  auto i = next.begin();
-  while (i != next.end()) {
-    /* if the spline is known to be accurate then do nothing */
-    if (!i->accurate) {
-      /* otherwise calculate the two midpoints */
-      double m = (i->L + i->R) * 0.5;
-      double ml = (i->L + m) * 0.5;
-      double mr = (i->R + m) * 0.5;
- 
-      /* calculate the values at the midpoints */
-      double yl = ml + prev.Integrate(ml, var);
-      double yr = mr + prev.Integrate(mr, var);
-   
-      /* and the errors with respect to the current spline */
-      double errl = abs(yl - i->val(ml));
-      double errr = abs(yr - i->val(mr));
-
-      /* if the error is large enough, then split the quadratic into two */
-      if (max(errl,errr) > tolerance) { 
-        /* create two new quadratics to replace the old */
-        Quadratic q1(i->L, i->left_val(), ml, yl, m, i->middle_val()); 
-        Quadratic q2(m, i->middle_val(), mr, yr, i->R, i->right_val());
-        
-        /* if original spline was accurate in one half, then the new one should be too, so
-        we don't need to check next time (saves some integrals) */
-        q1.accurate = (errl < tolerance);
-        q2.accurate = (errr < tolerance);
-        
-        /* erease the old spline and insert the new ones */
-        i = next.erase(i);
-        i = next.insert(i, q2);
-        i = next.insert(i, q1);
-        continue;
+
+/* accepts a filename, horizon, tolerance and number of threads. Writes a table of indices. Finished
+diagonals are logged to <fn>.ckpt, so rerunning an interrupted build resumes it. Diagonals t <= n0 are
+copied from the table `from` with horizon n0 if one is given. With stream the table is written to disk as
+it is computed */
+void BuildTable(string fn, int n, double tolerance, int max_threads, bool warm, string from, bool stream) {
+  TableOutput out(fn, n, tolerance, stream);
+  vector<bool> done(n + 1, false);
+
+  if (!from.empty()) {
+    GittinsTable old(from);
+    auto map = TableMapping::open(from);
+    /* tables without a header do not record their tolerance */
+    if (map->header.valid() && map->header.tolerance != tolerance) {
+      cout << from << " was built with tolerance " << map->header.tolerance << "\n";
+      assert(false);
+    }
+    uint64_t n0 = min((uint64_t)n, old.horizon());
+    vector<double> idx;
+    for (uint64_t t = 2;t <= n0;++t) {
+      idx.assign(t + 1, 0.0);
+      for (uint64_t m = 2;m <= t;++m) {
+        idx[m] = old.get_idx(m, t + 1 - m);
+      }
+      out.write(t, idx);
+      done[t] = true;
+    }
+    cout << "copied " << (n0 < 2 ? 0 : n0 - 1) << " diagonals from " << from << "\n";
+  }
+
+  /* a log without indices refers to diagonals already in a streamed file, which is useless if the file was
+  not kept */
+  string ckpt = fn + ".ckpt";
+  if (stream && !out.resumed()) {
+    unlink(ckpt.c_str());
+  }
+  DiagonalLog log(ckpt, tolerance, n, 0, 1, stream ? 0 : DiagonalLog::INDICES);
+  if (!stream && !(log.head.flags & DiagonalLog::INDICES)) {
+    cout << ckpt << " is from a streamed build, resume it with --stream\n";
+    exit(1);
+  }
+  uint64_t resumed = log.replay([&](uint64_t t, const vector<double> &idx) {
+    if (t <= (uint64_t)n && !done[t]) {
+      if (!idx.empty()) {
+        out.write(t, idx);
       }
+      done[t] = true;
     }
-    ++i;
+  });
+  if (resumed != 0) {
+    cout << "resuming with " << resumed << " diagonals from " << ckpt << "\n";
   }
-  next.L = next.begin()->L;
-}
 
-/* compute the index */
-void ComputeIndex(int n, int T, double tolerance, GittinsTable *table) {
-  /* the first value function is just the hinge function */ 
-  Spline first;
-  first.L = 0.0;
-  first.a = 1.0;
-  first.R = 0.0;
+  ComputeDiagonals(n, tolerance, max_threads, warm, done, [&out, &log](uint64_t t, const vector<double> &idx) {
+    out.write(t, idx);
+    log.append(t, idx);
+  });
 
+  out.finish();
+  log.remove();
+}
 
-  /* iterate starting from the end and backup the value function and push the index */
-  for (int t = 2; t!= n+1;++t) {
-    Spline next;
+/* computes the diagonals t <= n with t % shards == shard into the log fn, without holding a table. Rerunning
+resumes an interrupted shard */
+void BuildShard(string fn, int n, double tolerance, int max_threads, bool warm, uint64_t shard, uint64_t shards) {
+  DiagonalLog log(fn, tolerance, n, shard, shards);
+  assert(log.head.horizon == (uint64_t)n && log.head.shard == shard && log.head.shards == shards);
 
-    /* compute the inverse variance of the posterior */
-    uint64_t Tn = (T + n - t);
+  vector<bool> done(n + 1, false);
+  for (int t = 2;t <= n;++t) {
+    done[t] = (t % shards != shard);
+  }
+  uint64_t resumed = log.replay([&done](uint64_t t, const vector<double> &idx) {
+    done[t] = true;
+  });
+  if (resumed != 0) {
+    cout << "resuming with " << resumed << " diagonals from " << fn << "\n";
+  }
 
-    /* compute the variance at this level */
-    double var = 1.0 / (Tn * (Tn+1));
+  ComputeDiagonals(n, tolerance, max_threads, warm, done, [&log](uint64_t t, const vector<double> &idx) {
+    log.append(t, idx);
+  });
+}
 
-    /* backup */
-    Backup(first, next, t, var, tolerance);
+/* assembles the table fn from the shard logs, which must be from the same build and cover every diagonal */
+void MergeShards(string fn, const vector<string> &shards, bool stream) {
+  assert(!shards.empty());
+  DiagonalLog::Head first = DiagonalLog(shards[0]).head;
+  uint64_t n = first.horizon;
+  TableOutput out(fn, n, first.tolerance, stream);
+  vector<bool> seen(n + 1, false);
+  vector<bool> shard_seen(first.shards, false);
+
+  for (auto &s : shards) {
+    DiagonalLog log(s);
+    const DiagonalLog::Head &h = log.head;
+    if (h.tolerance != first.tolerance || h.horizon != n || h.shards != first.shards) {
+      cout << s << " is from a different build\n";
+      assert(false);
+    }
+    assert(h.shard < h.shards);
+    if (shard_seen[h.shard]) {
+      cout << s << " repeats shard " << h.shard << "\n";
+      assert(false);
+    }
+    shard_seen[h.shard] = true;
+    assert(h.flags & DiagonalLog::INDICES);
+    log.replay([&](uint64_t t, const vector<double> &idx) {
+      assert(t % h.shards == h.shard);
+      out.write(t, idx);
+      seen[t] = true;
+    });
+  }
 
-    /* add the gittins index */
-    if (table != nullptr) {
-      table->set_idx(t, Tn, -next.begin()->L);
-    }else if (t == n) {
-      cout << "index for (" << t << ", " << Tn << ") is " << -next.begin()->L << " based on " << next.size() << " splines\n";
+  uint64_t missing = 0;
+  for (uint64_t t = 2;t <= n;++t) {
+    if (!seen[t]) {
+      if (missing++ < 10) {
+        cout << "diagonal " << t << " (shard " << t % first.shards << ") is missing\n";
+      }
+    }
+  }
+  if (missing != 0) {
+    cout << missing << " diagonals are missing, the table is incomplete\n";
+    if (stream) {
+      unlink(fn.c_str());
     }
-    first = next;
+    exit(1);
   }
+  out.finish();
 }
 
-/* accepts a filename, horizon, tolerance and number of threads. Writes
-a table of indices */
-void BuildTable(string fn, int n, double tolerance, int max_threads) {
-  Pool<int> pool(max_threads);  
-  GittinsTable *table = new GittinsTable(n);
-  for (int t = n;t!=0;--t) {
-    pool.push([t, tolerance,table]{ComputeIndex(t, 1, tolerance, table); return 0;});
+/* builds the table of Bernoulli indices, one job per number of observations s + f. Within a job
+the index with m - 1 rounds remaining is a lower bound that warm starts the one with m */
+void BuildBernoulliTable(string fn, int n, double tolerance, int max_threads, double alpha, double beta) {
+  Pool<int> pool(max_threads, placement);
+  BernoulliGittinsTable *table = new BernoulliGittinsTable(n);
+  for (int N = 0;N != n;++N) {
+    pool.push([N, n, tolerance, alpha, beta, table] {
+      vector<double> work;
+      for (int s = 0;s <= N;++s) {
+        double lower = 0.0;
+        for (int m = 1;m + N <= n;++m) {
+          lower = BernoulliIndex(m, s, N - s, alpha, beta, tolerance, lower, work);
+          table->set_idx(m, s, N - s, lower);
+        }
+      }
+      return 0;
+    });
   }
   pool.run();
-  
-  table->write(fn);
+
+  table->write(fn, tolerance, alpha, beta);
+}
+
+/* compresses one block of cnt <= COMPRESSED_BLOCK values for T = T0, T0 + 1, ..., appending any residuals to
+res */
+CompressedBlock CompressBlock(const double *v, uint64_t T0, uint64_t cnt, double maxerr, vector<char> &res) {
+  const int D = COMPRESSED_DEGREE + 1;
+  CompressedBlock b;
+  memset(&b, 0, sizeof(b));
+  double logT[COMPRESSED_BLOCK];
+  for (uint64_t k = 0;k != cnt;++k) {
+    logT[k] = log((double)(T0 + k));
+  }
+  double lo = log((double)T0), hi = log((double)(T0 + cnt - 1));
+  b.center = 0.5 * (lo + hi);
+  b.width = cnt > 1 ? 2.0 / (hi - lo) : 1.0;
+
+  /* least squares polynomial through the normal equations, solved with partial pivoting */
+  if (cnt >= (uint64_t)D) {
+    double A[D][D + 1];
+    memset(A, 0, sizeof(A));
+    for (uint64_t k = 0;k != cnt;++k) {
+      double u = (logT[k] - b.center) * b.width;
+      double p[D];
+      p[0] = 1.0;
+      for (int i = 1;i != D;++i) {
+        p[i] = p[i - 1] * u;
+      }
+      for (int i = 0;i != D;++i) {
+        for (int j = 0;j != D;++j) {
+          A[i][j]+=p[i] * p[j];
+        }
+        A[i][D]+=p[i] * v[k];
+      }
+    }
+    for (int i = 0;i != D;++i) {
+      int piv = i;
+      for (int j = i + 1;j != D;++j) {
+        if (abs(A[j][i]) > abs(A[piv][i])) {
+          piv = j;
+        }
+      }
+      for (int j = 0;j != D + 1;++j) {
+        swap(A[i][j], A[piv][j]);
+      }
+      for (int j = i + 1;j != D;++j) {
+        double f = A[j][i] / A[i][i];
+        for (int l = i;l != D + 1;++l) {
+          A[j][l]-=f * A[i][l];
+        }
+      }
+    }
+    double c[D];
+    for (int i = D - 1;i >= 0;--i) {
+      c[i] = A[i][D];
+      for (int j = i + 1;j != D;++j) {
+        c[i]-=A[i][j] * c[j];
+      }
+      c[i]/=A[i][i];
+      b.c[i] = c[i];
+    }
+  }
+
+  /* residuals with respect to the polynomial as it will be evaluated */
+  double r[COMPRESSED_BLOCK];
+  double maxabs = 0.0;
+  for (uint64_t k = 0;k != cnt;++k) {
+    r[k] = v[k] - b.eval(k, logT[k], nullptr);
+    maxabs = max(maxabs, abs(r[k]));
+  }
+  if (maxabs <= maxerr) {
+    return b;
+  }
+
+  /* residuals in steps of just under 2 maxerr, so rounding stays within the bound, using as few bits as
+  the largest one needs. Every value is checked and the step shrinks if float rounding breaks the bound */
+  b.offset = res.size();
+  vector<char> packed;
+  for (double step = 1.98 * maxerr;step > 0.5 * maxerr;step*=0.9) {
+    b.scale = step;
+    double qmax = round(maxabs / (double)b.scale);
+    b.bits = 1;
+    while (b.bits != 32 && (double)(1ll << (b.bits - 1)) <= qmax) {
+      b.bits++;
+    }
+    if ((double)(1ll << (b.bits - 1)) <= qmax) {
+      break;
+    }
+    packed.assign((cnt * b.bits + 7) / 8 + 8, 0);
+    for (uint64_t k = 0;k != cnt;++k) {
+      uint64_t q = (uint64_t)(llround(r[k] / (double)b.scale) + (1ll << (b.bits - 1)));
+      uint64_t pos = k * b.bits;
+      uint64_t w;
+      memcpy(&w, packed.data() + pos / 8, sizeof(w));
+      w |= q << (pos % 8);
+      memcpy(packed.data() + pos / 8, &w, sizeof(w));
+    }
+    CompressedBlock local = b;
+    local.offset = 0;
+    bool ok = true;
+    for (uint64_t k = 0;k != cnt;++k) {
+      ok = ok && abs(local.eval(k, logT[k], packed.data()) - v[k]) <= maxerr;
+    }
+    if (ok) {
+      /* the padding is only needed after the last block */
+      res.insert(res.end(), packed.begin(), packed.end() - 8);
+      return b;
+    }
+  }
+  b.bits = CompressedBlock::RAW;
+  res.insert(res.end(), (const char*)v, (const char*)(v + cnt));
+  return b;
+}
+
+/* writes a compressed copy of a finite-horizon table with every index within maxerr of the original */
+void CompressTable(string in, string out, double maxerr) {
+  GittinsTable table(in);
+  uint64_t n = table.horizon();
+
+  vector<CompressedBlock> blocks;
+  vector<char> res;
+  /* blocks by type, and residual bits over the packed blocks */
+  uint64_t polynomial = 0, packed = 0, raw = 0, bits = 0;
+  double v[COMPRESSED_BLOCK];
+  for (uint64_t r = 0;r != n;++r) {
+    uint64_t m = n - r;
+    for (uint64_t k0 = 0;k0 <= r;k0+=COMPRESSED_BLOCK) {
+      uint64_t cnt = min(COMPRESSED_BLOCK, r + 1 - k0);
+      for (uint64_t k = 0;k != cnt;++k) {
+        v[k] = table.get_idx(m, k0 + k + 1);
+      }
+      blocks.push_back(CompressBlock(v, k0 + 1, cnt, maxerr, res));
+      uint32_t b = blocks.rbegin()->bits;
+      if (b == CompressedBlock::POLYNOMIAL) {
+        polynomial++;
+      }else if (b == CompressedBlock::RAW) {
+        raw++;
+      }else {
+        packed++;
+        bits+=b;
+      }
+    }
+  }
+  assert(blocks.size() == CompressedBlock::row_start(n));
+
+  /* eval loads 8 bytes at a time, so the residuals are padded */
+  res.resize(res.size() + 8, 0);
+  vector<char> payload(blocks.size() * sizeof(CompressedBlock) + res.size());
+  memcpy(payload.data(), blocks.data(), blocks.size() * sizeof(CompressedBlock));
+  memcpy(payload.data() + blocks.size() * sizeof(CompressedBlock), res.data(), res.size());
+
+  TableHeader h;
+  h.kind = TableHeader::COMPRESSED;
+  h.element = TableHeader::BYTE;
+  h.horizon = n;
+  h.param[0] = maxerr;
+  h.param[1] = COMPRESSED_BLOCK;
+  auto src = TableMapping::open(in);
+  h.tolerance = src->header.valid() ? src->header.tolerance : 0.0;
+  WriteTable(out, h, payload.data(), payload.size());
+
+  cout << blocks.size() << " blocks: " << polynomial << " polynomial, " << packed << " packed (" << (packed ? (double)bits / packed : 0.0)
+       << " bits per residual), " << raw << " raw\n";
+  cout << "compressed " << n * (n + 1) / 2 * sizeof(double) << " bytes to " << payload.size() << " ("
+       << (double)n * (n + 1) / 2 * sizeof(double) / payload.size() << "x)\n";
 }
 
 
 int main(int argc, char *argv[]) {
+  /* options follow the other arguments. --warm starts each backup from the breakpoints of the previous level,
+  --from=file reuses the diagonals of a smaller table, --stream writes the table to disk as it is built and
+  --cores=list pins the threads to the listed cores ("all" for every core the process may use) */
+  bool warm = false;
+  bool stream = false;
+  string from;
+  while (argc > 2 && !strncmp(argv[argc - 1], "--", 2)) {
+    if (!strcmp(argv[argc - 1], "--warm")) {
+      warm = true;
+    }else if (!strcmp(argv[argc - 1], "--stream")) {
+      stream = true;
+    }else if (!strncmp(argv[argc - 1], "--from=", 7)) {
+      from = argv[argc - 1] + 7;
+    }else if (!strncmp(argv[argc - 1], "--cores=", 8)) {
+      placement = Placement(argv[argc - 1] + 8);
+    }else {
+      goto die;
+    }
+    --argc;
+  }
+
   if (argc <= 1) {
     goto die;
   }
@@ -264,7 +693,29 @@ int main(int argc, char *argv[]) {
     assert(max_threads >= 1);
     assert(tolerance > 0);
 
-    BuildTable(fn, n, tolerance, max_threads);
+    BuildTable(fn, n, tolerance, max_threads, warm, from, stream);
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "shard") && argc == 8) {
+    string fn = string(argv[2]);
+    uint64_t n = atoi(argv[3]);
+    double tolerance = atof(argv[4]);
+    uint64_t max_threads = atoi(argv[5]);
+    uint64_t shard = atoi(argv[6]);
+    uint64_t shards = atoi(argv[7]);
+
+    assert(n >= 1);
+    assert(max_threads >= 1);
+    assert(tolerance > 0);
+    assert(shard < shards);
+
+    BuildShard(fn, n, tolerance, max_threads, warm, shard, shards);
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "merge") && argc >= 4) {
+    MergeShards(argv[2], vector<string>(argv + 3, argv + argc), stream);
     return 0;
   }
 
@@ -277,14 +728,114 @@ int main(int argc, char *argv[]) {
     assert(T >= 1);
     assert(tolerance > 0);
 
-    ComputeIndex(m, T, tolerance, nullptr);
+    ComputeIndex(m, T, tolerance, warm);
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "compress") && (argc == 4 || argc == 5)) {
+    /* by default allow the same error as the build tolerance of the distributed tables */
+    double maxerr = (argc == 5) ? atof(argv[4]) : 0.000005;
+    assert(maxerr > 0);
+    CompressTable(argv[2], argv[3], maxerr);
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "info") && argc == 3) {
+    auto map = TableMapping::open(argv[2]);
+    const TableHeader &h = map->header;
+    if (!h.valid()) {
+      cout << "no header, " << map->bytes / sizeof(double) << " doubles\n";
+      return 0;
+    }
+    const char *kinds[] = {"unknown", "finite", "discounted", "bernoulli", "compressed", "bayes"};
+    cout << "kind " << kinds[h.kind <= 5 ? h.kind : 0] << "\n";
+    cout << "version " << h.version << "\n";
+    const char *elements[] = {"unknown", "double", "float", "byte"};
+    cout << "element " << elements[h.element <= 3 ? h.element : 0] << "\n";
+    if (h.kind == TableHeader::FINITE) {
+      cout << "layout " << ((h.flags & TableHeader::DIAGONAL_MAJOR) ? "diagonals" : "rows") << "\n";
+    }
+    cout << "horizon " << h.horizon << "\n";
+    cout << "count " << h.count << "\n";
+    cout << "tolerance " << h.tolerance << "\n";
+    cout << "parameters " << h.param[0] << " " << h.param[1] << "\n";
+    cout << "checksum " << (map->verify() ? "ok" : "BAD") << "\n";
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "discounted") && (argc == 6 || argc == 7)) {
+    string fn = string(argv[2]);
+    double gamma = atof(argv[3]);
+    uint64_t n = atoi(argv[4]);
+    double tolerance = atof(argv[5]);
+    /* by default start the sweep ten effective horizons beyond the table */
+    uint64_t depth = (argc == 7) ? atoi(argv[6]) : ceil(10.0 / (1.0 - gamma));
+
+    assert(gamma > 0 && gamma < 1);
+    assert(n >= 2);
+    assert(tolerance > 0);
+    assert(depth >= 1);
+
+    vector<double> idx;
+    ComputeDiscounted(gamma, n, depth, tolerance, idx);
+    DiscountedGittinsTable(gamma, idx).write(fn, tolerance);
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "discounted-lookup") && argc == 4) {
+    string fn = string(argv[2]);
+    uint64_t T = atoi(argv[3]);
+
+    assert(T >= 1);
+
+    DiscountedGittinsTable table(fn);
+    cout << table.get_idx(T) << "\n";
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "bernoulli") && (argc == 6 || argc == 8)) {
+    string fn = string(argv[2]);
+    uint64_t n = atoi(argv[3]);
+    double tolerance = atof(argv[4]);
+    uint64_t max_threads = atoi(argv[5]);
+    double alpha = (argc == 8) ? atof(argv[6]) : 1.0;
+    double beta = (argc == 8) ? atof(argv[7]) : 1.0;
+
+    assert(n >= 1);
+    assert(max_threads >= 1);
+    assert(tolerance > 0);
+    assert(alpha > 0 && beta > 0);
+
+    BuildBernoulliTable(fn, n, tolerance, max_threads, alpha, beta);
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "bernoulli-lookup") && argc == 6) {
+    string fn = string(argv[2]);
+    uint64_t m = atoi(argv[3]);
+    uint64_t s = atoi(argv[4]);
+    uint64_t f = atoi(argv[5]);
+
+    BernoulliGittinsTable table(fn);
+    assert(m >= 1);
+    assert(m + s + f <= table.horizon());
+    cout << table.get_idx(m, s, f) << "\n";
     return 0;
   }
 
 die:
-  cout << "Usage: makegittins build filename horizon tolerance maxthreads\n";
+  cout << "Usage: makegittins build filename horizon tolerance maxthreads [--warm] [--stream] [--from=smaller table]\n"
+       << "       [--cores=list]\n";
+  cout << "   or: makegittins shard filename horizon tolerance maxthreads index count [--warm] [--cores=list]\n";
+  cout << "   or: makegittins merge filename shard... [--stream]\n";
   cout << "   or: makegittins lookup filename n T\n";
-  cout << "   or: makegittins compute n T tolerance\n";
+  cout << "   or: makegittins compute n T tolerance [--warm]\n";
+  cout << "   or: makegittins compress filename output [maxerr]\n";
+  cout << "   or: makegittins info filename\n";
+  cout << "   or: makegittins discounted filename gamma horizon tolerance [depth]\n";
+  cout << "   or: makegittins discounted-lookup filename T\n";
+  cout << "   or: makegittins bernoulli filename horizon tolerance maxthreads [alpha beta] [--cores=list]\n";
+  cout << "   or: makegittins bernoulli-lookup filename m s f\n";
   return 0;
 }
 
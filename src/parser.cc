@@ -15,6 +15,14 @@ see http://creativecommons.org/publicdomain/zero/1.0/
 /******************************************************
 * This is designed to read the binary data files and 
 * output a plain text table suitable for plotting.
+*
+* The logs are memory mapped and cut into chunks of
+* whole blocks (or entries, for the old format). Each
+* chunk is read by a pool worker into a hash table of
+* the values for every (x, id). The tables are merged
+* in the order of the chunks, so the values of each
+* (x, id) stay in file order and the output does not
+* depend on the number of threads.
 ******************************************************/
 #include <iostream>
 #include <vector>
@@ -23,82 +31,331 @@ see http://creativecommons.org/publicdomain/zero/1.0/
 #include <set>
 #include <map>
 #include <cstdint>
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <iterator>
+
+#include <glob.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "data.h"
 #include "log.h"
+#include "pool.h"
 
 using namespace std;
 
 
 
 
-int main(int argc, char* argv[]) {
-  if (argc != 2) {
-    cout << "bad arguments\n";
-    return 0;
-  }
-  map<double,map<int,Data> > table;
-  string line;
-  ifstream in(argv[1], ios::in | ios::ate);
-  auto end = in.tellg();
-  uint64_t size = end;
-  uint64_t pos = 0;
-  uint64_t block_size = 500000;
-  vector<LogEntry> data(block_size);
-  in.seekg(0, ios::beg);
-  while (pos != size) {
-    uint64_t read_number = block_size;
-    if ((size - pos) / sizeof(LogEntry) < block_size) {
-      read_number = (size - pos) / sizeof(LogEntry);
+/* the files named by arg: every file in a directory, the matches of a glob, or a log together with its shards
+<log>.<host>.<pid>.<tid> */
+void FindLogs(string arg, set<string> &files) {
+  struct stat st;
+  if (stat(arg.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(arg.c_str());
+    assert(dir != nullptr);
+    while (struct dirent *e = readdir(dir)) {
+      string fn = arg + "/" + e->d_name;
+      if (stat(fn.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        files.insert(fn);
+      }
     }
-    cerr << "reading " << read_number << "\n";
-    in.read((char*)data.data(), sizeof(LogEntry) * read_number);
-    pos+=sizeof(LogEntry) * read_number;
-
-
-    for (uint64_t i = 0;i != read_number;++i) {
-      auto iter1 = table.find(data[i].x);
-      if (iter1 == table.end()) {
-        table[data[i].x] = {{data[i].id, Data(data[i].y)}};
-      }else {
-        auto iter2 = iter1->second.find(data[i].id);
-        if (iter2 == iter1->second.end()) {
-          iter1->second[data[i].id] = Data(data[i].y);
-        }else {
-          iter2->second << data[i].y;
+    closedir(dir);
+    return;
+  }
+  vector<string> patterns = {arg};
+  if (arg.find_first_of("*?[") == string::npos) {
+    patterns.push_back(arg + ".*");
+  }
+  for (auto &p : patterns) {
+    glob_t g;
+    if (glob(p.c_str(), 0, nullptr, &g) == 0) {
+      for (size_t i = 0;i != g.gl_pathc;++i) {
+        if (stat(g.gl_pathv[i], &st) == 0 && S_ISREG(st.st_mode)) {
+          files.insert(g.gl_pathv[i]);
         }
       }
     }
+    globfree(&g);
   }
-  cout << "\%x ";
-  for (auto &alg : table.begin()->second) {
-    cout << alg.first << " ";
+}
+
+/* aim for chunks of this many bytes */
+static const uint64_t CHUNK_BYTES = 16 << 20;
+
+class Key {
+  public:
+  double x;
+  int id;
+
+  bool operator==(const Key &k)const {
+    return x == k.x && id == k.id;
   }
-  cout << "\n";
-  for (auto &x : table) {
-    cout << x.first << " ";
-    for (auto &alg : x.second) {
-      cout << alg.second.mean() << " ";
+};
+
+class KeyHash {
+  public:
+  size_t operator()(const Key &k)const {
+    /* adding 0.0 maps -0.0 to 0.0, which compare equal */
+    double x = k.x + 0.0;
+    uint64_t h;
+    memcpy(&h, &x, 8);
+    h ^= (uint64_t)(uint32_t)k.id * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+  }
+};
+
+/* the values of y for each (x, id) as one piece per chunk, in the order of the chunks. Merging moves pieces, the
+values are copied once when the pieces are joined */
+typedef unordered_map<Key, vector<vector<double> >, KeyHash> Partial;
+
+/* a mapped log, unmapped once the last of its chunks has been read */
+class MappedLog {
+  public:
+  string fn;
+  const char *base;
+  uint64_t size;
+  atomic<size_t> unread;
+};
+
+/* bytes [begin, end) of a mapped log, whole blocks or whole entries */
+class Chunk {
+  public:
+  MappedLog *log;
+  uint64_t begin, end;
+  bool columnar;
+};
+
+/* maps fn and cuts it into chunks. Returns the number of bytes mapped */
+uint64_t MapLog(string fn, const LogFilter &filter, vector<unique_ptr<MappedLog> > &logs, vector<Chunk> &chunks) {
+  int fd = open(fn.c_str(), O_RDONLY);
+  assert(fd >= 0);
+  struct stat st;
+  fstat(fd, &st);
+  uint64_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return 0;
+  }
+  void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(m != MAP_FAILED);
+  close(fd);
+  madvise(m, size, MADV_SEQUENTIAL);
+  madvise(m, size, MADV_WILLNEED);
+  const char *base = (const char*)m;
+  MappedLog *log = new MappedLog;
+  log->fn = fn;
+  log->base = base;
+  log->size = size;
+  logs.emplace_back(log);
+  size_t first = chunks.size();
+
+  LogFileHeader head;
+  if (size < sizeof(head) || (memcpy(&head, base, sizeof(head)), !head.valid())) {
+    /* old format, ignoring a partial entry at the end */
+    uint64_t end = size / sizeof(LogEntry) * sizeof(LogEntry);
+    uint64_t step = CHUNK_BYTES / sizeof(LogEntry) * sizeof(LogEntry);
+    for (uint64_t p = 0;p < end;p+=step) {
+      chunks.push_back({log, p, min(p + step, end), false});
     }
-    for (auto &alg : x.second) {
-      cout << 2.0 * alg.second.standard_error() << " ";
+  }else {
+    /* group whole blocks into chunks, leaving out blocks the filter rejects and the gaps left by damaged headers */
+    uint64_t start = 0, end = 0;
+    auto cut = [&] {
+      if (start != end) {
+        chunks.push_back({log, start, end, true});
+      }
+    };
+    ScanLogBlocks(fn, base, size, [&](uint64_t p, const LogBlockHeader &h) {
+      if (p != end) {
+        cut();
+        start = end = p;
+      }
+      uint64_t next = p + sizeof(h) + h.payload();
+      if (!filter.want(h)) {
+        cut();
+        start = next;
+      }else if (next - start >= CHUNK_BYTES) {
+        end = next;
+        cut();
+        start = next;
+      }
+      end = next;
+    });
+    cut();
+  }
+  log->unread = chunks.size() - first;
+  if (log->unread == 0) {
+    munmap(m, size);
+  }
+  return size;
+}
+
+Partial ReadChunk(const Chunk &c, const LogFilter &filter) {
+  Partial out;
+  vector<double> *last = nullptr;
+  Key key = {0.0, 0};
+  auto add = [&out, &last, &key](int id, double x, const double *y, size_t n) {
+    if (last == nullptr || !(key == Key{x, id})) {
+      key = {x, id};
+      auto &pieces = out[key];
+      if (pieces.empty()) {
+        pieces.emplace_back();
+      }
+      last = &pieces[0];
     }
-    for (auto &alg : x.second) {
-      cout << alg.second.size() << " ";
+    last->insert(last->end(), y, y + n);
+  };
+  if (!c.columnar) {
+    for (uint64_t p = c.begin;p != c.end;p+=sizeof(LogEntry)) {
+      LogEntry e;
+      memcpy(&e, c.log->base + p, sizeof(e));
+      if (filter.want(e.id, e.x)) {
+        add(e.id, e.x, &e.y, 1);
+      }
     }
-    for (auto &alg : x.second) {
-      cout << alg.second.quantile(0.9) << " ";
+    return out;
+  }
+  vector<double> y;
+  for (uint64_t p = c.begin;p != c.end;) {
+    LogBlockHeader h;
+    memcpy(&h, c.log->base + p, sizeof(h));
+    if (!DecodeLogBlock(h, c.log->base + p + sizeof(h), filter, add, y)) {
+      cerr << c.log->fn << ": checksum of a block failed, skipping it\n";
     }
-    cout << "\n";
+    p+=sizeof(h) + h.payload();
   }
+  return out;
 }
 
 
+/* arguments are log files, directories of shards or globs. A log name also picks up its shards. --ids=0,2,5,
+--xmin=v and --xmax=v restrict the output, blocks without wanted entries are skipped. --threads=n sets the
+number of readers, by default one per core */
+int main(int argc, char* argv[]) {
+  set<string> files;
+  LogFilter filter;
+  unsigned int threads = max(1u, thread::hardware_concurrency());
+  for (int i = 1;i != argc;++i) {
+    if (!strncmp(argv[i], "--ids=", 6)) {
+      stringstream in(argv[i] + 6);
+      string id;
+      while (getline(in, id, ',')) {
+        filter.ids.insert(atoi(id.c_str()));
+      }
+    }else if (!strncmp(argv[i], "--xmin=", 7)) {
+      filter.x_min = atof(argv[i] + 7);
+    }else if (!strncmp(argv[i], "--xmax=", 7)) {
+      filter.x_max = atof(argv[i] + 7);
+    }else if (!strncmp(argv[i], "--threads=", 10)) {
+      threads = max(1, atoi(argv[i] + 10));
+    }else {
+      FindLogs(argv[i], files);
+    }
+  }
+  if (files.empty()) {
+    cout << "usage: parser [--ids=list] [--xmin=v] [--xmax=v] [--threads=n] log|directory|glob...\n";
+    return 0;
+  }
+  auto start = chrono::steady_clock::now();
+  vector<unique_ptr<MappedLog> > logs;
+  vector<Chunk> chunks;
+  uint64_t bytes = 0;
+  for (auto &fn : files) {
+    bytes+=MapLog(fn, filter, logs, chunks);
+  }
 
+  Partial all;
+  if (!chunks.empty()) {
+    Pool<Partial> pool(threads);
+    for (auto &c : chunks) {
+      pool.push([&c, &filter] {
+        Partial p = ReadChunk(c, filter);
+        if (--c.log->unread == 0) {
+          munmap((void*)c.log->base, c.log->size);
+        }
+        return p;
+      });
+    }
+    /* b holds later chunks than a */
+    all = pool.reduce([](Partial &a, Partial &b) {
+      for (auto &e : b) {
+        auto &pieces = a[e.first];
+        if (pieces.empty()) {
+          pieces.swap(e.second);
+        }else {
+          pieces.insert(pieces.end(), make_move_iterator(e.second.begin()), make_move_iterator(e.second.end()));
+        }
+      }
+      return std::move(a);
+    }, false);
+  }
 
+  map<double,map<int,Data> > table;
+  for (auto &e : all) {
+    Data &d = table[e.first.x][e.first.id];
+    auto &pieces = e.second;
+    if (pieces.size() == 1) {
+      d.data.swap(pieces[0]);
+    }else {
+      size_t total = 0;
+      for (auto &v : pieces) {
+        total+=v.size();
+      }
+      d.data.reserve(total);
+      for (auto &v : pieces) {
+        d.data.insert(d.data.end(), v.begin(), v.end());
+        vector<double>().swap(v);
+      }
+    }
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cerr << "read " << bytes << " bytes from " << files.size() << " files in " << chunks.size() << " chunks with "
+       << threads << " threads, " << seconds << " s (" << bytes / seconds / 1e9 << " GB/s)\n";
 
+  if (table.empty()) {
+    cout << "no entries found\n";
+    return 0;
+  }
+  cout << "\%x ";
+  for (auto &alg : table.begin()->second) {
+    cout << alg.first << " ";
+  }
+  cout << "\n";
 
-
-
-
-
+  /* the rows are independent, so they are formatted in parallel and printed in order */
+  Pool<string> rows(threads);
+  for (auto &x : table) {
+    rows.push([&x] {
+      stringstream out;
+      out << x.first << " ";
+      for (auto &alg : x.second) {
+        out << alg.second.mean() << " ";
+      }
+      for (auto &alg : x.second) {
+        out << 2.0 * alg.second.standard_error() << " ";
+      }
+      for (auto &alg : x.second) {
+        out << alg.second.size() << " ";
+      }
+      for (auto &alg : x.second) {
+        out << alg.second.quantile(0.9) << " ";
+      }
+      out << "\n";
+      return out.str();
+    });
+  }
+  for (auto &row : rows.run(false)) {
+    cout << row;
+  }
+}
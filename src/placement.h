@@ -0,0 +1,141 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/********************************************************************
+Where the threads of a pool run.
+
+A Placement is a list of cores, worker i is pinned to core i (wrapping
+around if there are more workers than cores). Cores are given as a
+list such as "0-7,16-23", "all" for every core the process may use or
+"none" to leave the threads unpinned.
+
+The NUMA node of each core is read from /sys/devices/system/node. On
+machines with one node, or without that directory, every core is on
+node 0, so NodeLocal data is simply shared.
+********************************************************************/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
+class Placement {
+  public:
+  /* unpinned */
+  Placement() {
+  }
+
+  Placement(std::string list) {
+    if (list == "none") {
+      return;
+    }
+    std::vector<int> allowed = available();
+    if (list == "all") {
+      cores = allowed;
+    }else {
+      for (int c : parse(list)) {
+        if (std::find(allowed.begin(), allowed.end(), c) != allowed.end()) {
+          cores.push_back(c);
+        }else {
+          std::cerr << "core " << c << " is not available, skipping it\n";
+        }
+      }
+    }
+    node_of.assign(cores.size(), 0);
+    for (int node = 0;;++node) {
+      std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      std::string line;
+      if (!std::getline(in, line)) {
+        break;
+      }
+      for (int c : parse(line)) {
+        for (size_t i = 0;i != cores.size();++i) {
+          if (cores[i] == c) {
+            node_of[i] = node;
+          }
+        }
+      }
+    }
+  }
+
+  bool pinned()const {
+    return !cores.empty();
+  }
+
+  /* the core of worker i, or -1 if unpinned */
+  int core(unsigned int i)const {
+    return pinned() ? cores[i % cores.size()] : -1;
+  }
+
+  /* the NUMA node of worker i */
+  int node(unsigned int i)const {
+    return pinned() ? node_of[i % cores.size()] : 0;
+  }
+
+  /* one more than the largest node used */
+  int nodes()const {
+    return node_of.empty() ? 1 : *std::max_element(node_of.begin(), node_of.end()) + 1;
+  }
+
+  /* expands a list such as "0-3,8,10-11" */
+  static std::vector<int> parse(std::string list) {
+    std::vector<int> out;
+    size_t i = 0;
+    while (i < list.size()) {
+      size_t end = list.find(',', i);
+      if (end == std::string::npos) {
+        end = list.size();
+      }
+      std::string range = list.substr(i, end - i);
+      size_t dash = range.find('-');
+      if (!range.empty()) {
+        int lo = atoi(range.c_str());
+        int hi = dash == std::string::npos ? lo : atoi(range.c_str() + dash + 1);
+        for (int c = lo;c <= hi;++c) {
+          out.push_back(c);
+        }
+      }
+      i = end + 1;
+    }
+    return out;
+  }
+
+  /* cores in the affinity mask of the process */
+  static std::vector<int> available() {
+    std::vector<int> out;
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+      for (int c = 0;c != CPU_SETSIZE;++c) {
+        if (CPU_ISSET(c, &allowed)) {
+          out.push_back(c);
+        }
+      }
+    }
+#endif
+    return out;
+  }
+
+  private:
+  std::vector<int> cores;
+  std::vector<int> node_of;
+};
@@ -24,7 +24,20 @@ Pool<returntype> pool(max_threads);
 Call pool.add() to add jobs to the queue
 
 Call pool.run(), which runs jobs and returns a vector<returntype> of
-the results.
+the results in the order the jobs were added.
+
+Or call pool.reduce(combine), which folds the results with combine
+as the jobs finish and returns the total. Results are combined along
+a binary tree over the order the jobs were added, so floating point
+sums are the same for any number of threads, and only the partial
+results waiting for a neighbour are kept.
+
+The jobs run on a set of Workers that is kept between calls of run().
+By default they are unpinned, pass a Placement as the second
+argument of the constructor to pin them. run() blocks until the last job finishes, without polling.
+
+If a job throws, the jobs not yet started are skipped and run() or
+reduce() rethrows the first exception once the running ones finish.
 ********************************************************************/
 #pragma once
 
@@ -35,15 +48,281 @@ the results.
 #include <vector>
 #include <thread>
 #include <iostream>
-#include <functional>
-#include <chrono>
-#include <future>
+#include <memory>
+#include <map>
+#include <utility>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cassert>
+#include <exception>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "placement.h"
+
+/********************************************************************
+Persistent worker threads for jobs that create further jobs, such as
+dataflow schedules in which a job is started by whichever job
+finishes its last input.
+
+Each worker has its own deque. A job spawned by a worker goes on the
+back of that worker's deque and workers take their next job from the
+back, so a newly enabled job runs while its inputs are still in
+cache. An idle worker steals the oldest job from the front of another
+worker's deque.
+
+Workers workers(max_threads, placement);
+
+Each worker pins itself to its core of the placement before it runs
+any job, so memory it allocates is first touched on its own NUMA
+node. The default placement leaves the threads unpinned.
+
+Call workers.spawn() from any thread, including from inside a job.
+Jobs must not throw, an exception escaping a worker terminates the
+program. Pool catches the exceptions of its own jobs.
+
+Call workers.wait(), which returns when every job has finished.
+********************************************************************/
+class Workers {
+  public:
+  Workers(unsigned int max_threads, Placement placement = Placement()) : placement(placement), queues(max_threads),
+  queued(0), pending(0), sleeping(0), next(0), stop(false) {
+    assert(max_threads >= 1);
+    for (unsigned int i = 0;i != max_threads;++i) {
+      threads.push_back(std::thread([this, i] {
+        loop(i);
+      }));
+    }
+  }
+
+  ~Workers() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  Workers(const Workers&) = delete;
+  Workers &operator=(const Workers&) = delete;
+
+  unsigned int size()const {
+    return queues.size();
+  }
+
+  /* the index of the calling worker, or -1 if it is not one of ours */
+  int index()const {
+    auto &c = current();
+    return c.first == this ? c.second : -1;
+  }
+
+  /* the index of the calling thread in whichever Workers it belongs to, or -1 */
+  static int worker() {
+    return current().second;
+  }
+
+  /* the NUMA node of the calling worker, 0 if it is not a worker or is unpinned */
+  static int node() {
+    auto &c = current();
+    return c.first ? c.first->placement.node(c.second) : 0;
+  }
+
+  const Placement placement;
+
+  void spawn(std::function<void()> job) {
+    pending++;
+    int i = index();
+    if (i < 0) {
+      i = next++ % size();
+    }
+    {
+      std::lock_guard<std::mutex> lock(queues[i].m);
+      queues[i].jobs.push_back(std::move(job));
+    }
+    queued++;
+    /* a worker about to sleep either sees the job or is counted here */
+    if (sleeping > 0) {
+      std::lock_guard<std::mutex> lock(m);
+      wake.notify_one();
+    }
+  }
+
+  void wait() {
+    assert(index() < 0);
+    std::unique_lock<std::mutex> lock(m);
+    done.wait(lock, [this] {
+      return pending == 0;
+    });
+  }
+
+  private:
+  struct Queue {
+    std::mutex m;
+    std::deque<std::function<void()>> jobs;
+  };
+
+  static std::pair<const Workers*, int> &current() {
+    static thread_local std::pair<const Workers*, int> c(nullptr, -1);
+    return c;
+  }
+
+  /* pops from the back of queue i or steals from the front of another */
+  bool take(unsigned int i, std::function<void()> &job) {
+    for (unsigned int k = 0;k != size();++k) {
+      Queue &q = queues[(i + k) % size()];
+      std::lock_guard<std::mutex> lock(q.m);
+      if (!q.jobs.empty()) {
+        if (k == 0) {
+          job = std::move(q.jobs.back());
+          q.jobs.pop_back();
+        }else {
+          job = std::move(q.jobs.front());
+          q.jobs.pop_front();
+        }
+        queued--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void pin(unsigned int i) {
+#ifdef __linux__
+    if (placement.pinned()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(placement.core(i), &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+  }
+
+  void loop(unsigned int i) {
+    pin(i);
+    current() = std::make_pair(this, (int)i);
+    std::function<void()> job;
+    while (true) {
+      if (take(i, job)) {
+        job();
+        job = nullptr;
+        if (--pending == 0) {
+          std::lock_guard<std::mutex> lock(m);
+          done.notify_all();
+        }
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(m);
+      sleeping++;
+      wake.wait(lock, [this] {
+        return stop || queued > 0;
+      });
+      sleeping--;
+      if (stop) {
+        return;
+      }
+    }
+  }
+
+  std::vector<Queue> queues;
+  std::vector<std::thread> threads;
+  /* jobs in the deques, and jobs spawned but not finished */
+  std::atomic<int64_t> queued, pending;
+  std::atomic<int> sleeping;
+  std::atomic<unsigned int> next;
+  bool stop;
+  std::mutex m;
+  std::condition_variable wake, done;
+};
+
+
+
+/********************************************************************
+Per-worker contexts for the jobs of a pool, so that generators,
+bandits and algorithms are built once per thread and reused by every
+job it runs.
+
+WorkerLocal<Context> local(max_threads, [](int i) {
+  return new Context(...);
+});
+
+Inside a job, local.get() returns the context of the calling worker,
+made by the function above the first time that worker asks. Contexts
+live until the WorkerLocal is destroyed. Read-only data such as
+Gittins tables can be shared by all contexts.
+********************************************************************/
+template<class C> class WorkerLocal {
+  public:
+  WorkerLocal(unsigned int max_threads, std::function<C*(int)> make) : slots(max_threads), make(make) {
+  }
+
+  /* only worker i touches slot i, so no lock is needed */
+  C &get() {
+    int i = Workers::worker();
+    assert(i >= 0 && i < (int)slots.size());
+    if (!slots[i]) {
+      slots[i].reset(make(i));
+    }
+    return *slots[i];
+  }
+
+  private:
+  std::vector<std::unique_ptr<C>> slots;
+  std::function<C*(int)> make;
+};
+
+
+
+/********************************************************************
+One copy of read-only data per NUMA node, such as a Gittins table
+that every job reads.
+
+NodeLocal<GittinsTable> tables([&table](int node) {
+  return new GittinsTable(table.replicate());
+});
+
+Inside a job, tables.get() returns the copy for the node of the
+calling worker. It is made by the first worker on that node to ask,
+so its pages are on that node. Unpinned workers and single-node
+machines share one copy.
+********************************************************************/
+template<class C> class NodeLocal {
+  public:
+  NodeLocal(std::function<C*(int)> make) : make(make) {
+  }
+
+  const C &get() {
+    int node = Workers::node();
+    std::lock_guard<std::mutex> lock(m);
+    if ((int)copies.size() <= node) {
+      copies.resize(node + 1);
+    }
+    if (!copies[node]) {
+      copies[node].reset(make(node));
+    }
+    return *copies[node];
+  }
+
+  private:
+  std::function<C*(int)> make;
+  std::mutex m;
+  std::vector<std::unique_ptr<C>> copies;
+};
+
+
 
 template<class T> class Pool {
   public:
   unsigned int max_threads;
 
-  Pool(unsigned int max_threads) {
+  Pool(unsigned int max_threads, Placement placement = Placement()) : placement(placement) {
     this->max_threads = max_threads;
   }
 
@@ -53,51 +332,163 @@ template<class T> class Pool {
 
   std::vector<T> run(bool verbose = true);
 
+  /* combine(a, b) must be associative, a holds the results of earlier jobs than b. There must be at least one job */
+  template<class C> T reduce(C combine, bool verbose = true);
+
   std::queue<std::function<T()>> jobs;
-};
 
-template<class T>
-std::vector<T> Pool<T>::run(bool verbose) { 
-  std::vector<std::future<T>> threads;
-  std::vector<T> data;
+  private:
+  /* keeps the first exception thrown by a job */
+  class Failure {
+    public:
+    Failure() : failed(false) {
+    }
 
-  std::cout << "running pool with " << jobs.size() << " jobs\n";
+    bool operator()()const {
+      return failed;
+    }
 
-  int running = 0;
-  
-  while (jobs.size() > 0) {
-    if (threads.size() < max_threads) {
-      running++;
-      auto job = jobs.front();
-      if (verbose) {
-        std::cout << "starting job " << running << "\n";
+    void set(std::exception_ptr e) {
+      std::lock_guard<std::mutex> lock(m);
+      if (!first) {
+        first = e;
       }
-      jobs.pop();
-      threads.push_back(std::async(std::launch::async, [job] {
-        return job();
-      }));
+      failed = true;
     }
 
-    for (auto f = threads.begin();f!=threads.end();) {
-      auto status = f->wait_for(std::chrono::milliseconds(0));
-      if (status == std::future_status::ready) {
-        data.push_back(f->get());
-        f = threads.erase(f);
-      }else {
-        ++f;
+    void rethrow() {
+      if (failed) {
+        std::rethrow_exception(first);
       }
     }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    private:
+    std::atomic<bool> failed;
+    std::mutex m;
+    std::exception_ptr first;
+  };
 
+  void start() {
+    if (!workers || workers->size() != max_threads) {
+      workers.reset();
+      workers.reset(new Workers(max_threads, placement));
+    }
   }
 
-  for (auto &f : threads) {
-    data.push_back(f.get());
+  Placement placement;
+  std::unique_ptr<Workers> workers;
+};
+
+template<class T>
+std::vector<T> Pool<T>::run(bool verbose) { 
+  if (verbose) {
+    std::cout << "running pool with " << jobs.size() << " jobs\n";
+  }
+
+  start();
+
+  /* results are kept by position so that T need not be default constructible */
+  std::vector<std::unique_ptr<T>> results(jobs.size());
+  std::atomic<int> running(0);
+  Failure failure;
+  for (size_t i = 0;!jobs.empty();++i) {
+    std::function<T()> job = std::move(jobs.front());
+    jobs.pop();
+    workers->spawn([&results, &running, &failure, i, job, verbose] {
+      if (failure()) {
+        return;
+      }
+      if (verbose) {
+        std::string line = "starting job " + std::to_string(++running) + "\n";
+        std::cout << line;
+      }
+      try {
+        results[i].reset(new T(job()));
+      }catch (...) {
+        failure.set(std::current_exception());
+      }
+    });
   }
+  workers->wait();
+  failure.rethrow();
 
+  std::vector<T> data;
+  data.reserve(results.size());
+  for (auto &r : results) {
+    data.push_back(std::move(*r));
+  }
   return data;
 }
 
+template<class T> template<class C>
+T Pool<T>::reduce(C combine, bool verbose) {
+  if (verbose) {
+    std::cout << "running pool with " << jobs.size() << " jobs\n";
+  }
+
+  size_t n = jobs.size();
+  assert(n > 0);
+  start();
 
+  std::vector<std::function<T()>> list;
+  list.reserve(n);
+  while (!jobs.empty()) {
+    list.push_back(std::move(jobs.front()));
+    jobs.pop();
+  }
+
+  /* node (l, k) of the tree holds the total of jobs k * 2^l up to (k + 1) * 2^l, the root is (levels, 0). A
+  node without a right neighbour is passed up unchanged */
+  unsigned int levels = 0;
+  while (((size_t)1 << levels) < n) {
+    levels++;
+  }
+  std::map<std::pair<unsigned int, size_t>, T> partial;
+  std::mutex m;
+  std::unique_ptr<T> total;
 
+  auto insert = [&](size_t k, T value) {
+    for (unsigned int l = 0;l != levels;++l, k >>= 1) {
+      size_t other = k ^ 1;
+      if ((other << l) >= n) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(m);
+      auto it = partial.find(std::make_pair(l, other));
+      if (it == partial.end()) {
+        partial.emplace(std::make_pair(l, k), std::move(value));
+        return;
+      }
+      T neighbour = std::move(it->second);
+      partial.erase(it);
+      lock.unlock();
+      value = (k & 1) ? combine(neighbour, value) : combine(value, neighbour);
+    }
+    total.reset(new T(std::move(value)));
+  };
+
+  /* jobs are handed out in order so that few partial results wait for a neighbour */
+  std::atomic<size_t> next(0);
+  Failure failure;
+  for (unsigned int i = 0;i != max_threads && i != n;++i) {
+    workers->spawn([&list, &next, &insert, &failure, n, verbose] {
+      for (size_t k = next++;k < n && !failure();k = next++) {
+        if (verbose) {
+          std::string line = "starting job " + std::to_string(k + 1) + "\n";
+          std::cout << line;
+        }
+        try {
+          insert(k, list[k]());
+        }catch (...) {
+          failure.set(std::current_exception());
+        }
+      }
+    });
+  }
+  workers->wait();
+  /* the tree is incomplete, its partial results are dropped with it */
+  failure.rethrow();
+
+  assert(partial.empty());
+  return std::move(*total);
+}
@@ -0,0 +1,151 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+#include "spline.h"
+
+#include <cstring>
+
+using namespace std;
+
+static thread_local uint64_t integrals = 0;
+
+uint64_t SplineIntegrals() {
+  return integrals;
+}
+
+void ExpNeg(const double *x, double *y, size_t n) {
+  /* adding 1.5 * 2^52 rounds to an integer and leaves it in the low bits of the mantissa */
+  const double shift = 6755399441055744.0;
+  for (size_t i = 0;i != n;++i) {
+    double v = max(x[i], -700.0);
+    double t = v * 1.4426950408889634 + shift;
+    double k = t - shift;
+    /* v - k log(2) in two parts, |r| <= log(2) / 2 */
+    double r = (v - k * 6.93147180369123816490e-01) - k * 1.90821492927058770002e-10;
+    double p = 1.0 / 6227020800.0;
+    p = p * r + 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+    /* 2^k is built directly in the exponent field */
+    uint64_t bits;
+    memcpy(&bits, &t, sizeof(bits));
+    bits = (bits + 1023) << 52;
+    double scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    y[i] = p * scale;
+  }
+}
+
+double Spline::Integrate(double u, double v, double window)const {
+  return Evaluate(u, v, window, nullptr);
+}
+
+double Spline::IntegrateSlope(double u, double v, double &slope, double window)const {
+  return Evaluate(u, v, window, &slope);
+}
+
+void Spline::Integrate(const double *u, double *out, size_t k, double v, double window)const {
+  for (size_t j = 0;j != k;++j) {
+    out[j] = Evaluate(u[j], v, window, nullptr);
+  }
+}
+
+double Spline::Evaluate(double u, double v, double window, double *slope)const {
+  /* per-thread scratch for the exponents and the exp/erf values at the breakpoints */
+  static thread_local vector<double> work;
+  ++integrals;
+
+  /* the start of the asymptote is the last breakpoint, or the only one if there are no pieces */
+  const double *x = X.empty() ? &R : X.data();
+  size_t n = X.empty() ? 1 : X.size();
+
+  double sqrtv = sqrt(v);
+  double i2v = 0.5 / v;
+  // sqrt(1.0 / (2Pi)) = 0.3989422804014327
+  double c0 = 0.3989422804014327 * sqrtv;
+  // sqrt(0.5) = 0.7071067811865476
+  double i_sqrt2v = 0.7071067811865476 / sqrtv;
+
+  /* only breakpoints j0..j1 are evaluated. Those outside have exp = 0 and erf = +-1 to double precision, so the
+  pieces between them contribute nothing, except the asymptote which is a * u when it starts left of the window */
+  size_t j0 = 0;
+  size_t j1 = n - 1;
+  if (window > 0.0 && n > 1) {
+    j0 = lower_bound(x, x + n, u - window * sqrtv) - x;
+    j0 = (j0 == 0) ? 0 : j0 - 1;
+    j1 = min((size_t)(upper_bound(x, x + n, u + window * sqrtv) - x), n - 1);
+  }
+  size_t m = j1 - j0 + 1;
+  work.resize(3 * m);
+  double *D = work.data();
+  double *E = D + m;
+  double *F = E + m;
+  const double *xs = x + j0;
+
+  for (size_t i = 0;i != m;++i) {
+    D[i] = -(xs[i] - u) * (xs[i] - u) * i2v;
+  }
+  ExpNeg(D, E, m);
+  for (size_t i = 0;i != m;++i) {
+    F[i] = erf((u - xs[i]) * i_sqrt2v);
+  }
+
+  /* this is for the linear asymptote, erfc((R - u) / sqrt(2v)) = 1 + erf((u - R) / sqrt(2v)) */
+  double sum = 0.0;
+  double ds = 0.0;
+  if (j1 == n - 1) {
+    sum = a * c0 * E[m - 1] + 0.5 * a * u * (1.0 + F[m - 1]);
+    ds = 0.5 * a * (1.0 + F[m - 1]);
+  }
+
+  /* now the quadratic pieces, whose derivatives 2Ax + B integrate in the same way */
+  double uu = u * u + v;
+  const double *a2 = A.data() + j0;
+  const double *b2 = B.data() + j0;
+  const double *c2 = C.data() + j0;
+  for (size_t i = 0;i + 1 < m;++i) {
+    double t1 = c0 * (E[i] * (b2[i] + a2[i] * (xs[i] + u)) - E[i + 1] * (b2[i] + a2[i] * (xs[i + 1] + u)));
+    double t2 = 0.5 * (c2[i] + b2[i] * u + a2[i] * uu);
+    sum+=t1 + t2 * (F[i] - F[i + 1]);
+  }
+  if (slope != nullptr) {
+    for (size_t i = 0;i + 1 < m;++i) {
+      ds+=0.5 * (2.0 * a2[i] * u + b2[i]) * (F[i] - F[i + 1]) + 2.0 * a2[i] * c0 * (E[i] - E[i + 1]);
+    }
+    *slope = ds;
+  }
+  return sum;
+}
+
+double Spline::Value(double x)const {
+  if (X.empty() || x < X[0]) {
+    return 0.0;
+  }
+  if (x >= R) {
+    return a * x;
+  }
+  size_t i = upper_bound(X.begin(), X.end(), x) - X.begin() - 1;
+  i = min(i, A.size() - 1);
+  return (A[i] * x + B[i]) * x + C[i];
+}
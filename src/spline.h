@@ -0,0 +1,197 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/**************************************************************************
+Piecewise quadratic value functions with a linear right asymptote, shared by
+makegittins and makebayes.
+
+The pieces of a spline are contiguous, so they are stored as arrays of
+coefficients and breakpoints (piece i spans [X[i], X[i+1]]). Integrating
+against a Gaussian needs exp and erf at the ends of every piece; with shared
+breakpoints these are evaluated once per breakpoint rather than twice per
+piece, and the exp loop is written so that the compiler vectorises it. Only
+breakpoints within a window of the mean are evaluated, found by binary
+search; pieces outside it integrate to zero to double precision.
+
+Refine() builds a spline by adaptive bisection using an explicit stack of
+pending pieces, so no memory is allocated per piece.
+**************************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+/* default number of standard deviations either side of the mean that Spline::Integrate looks at. Beyond 10
+the Gaussian weight is below 1e-22 */
+#define SPLINE_WINDOW 10.0
+
+/* stores data for a quadratic spline */
+class Quadratic {
+  public:
+
+  /* store quadratic as "ax^2 + bx + c" */
+  double a,b,c;
+
+  /* start and end of spline */
+  double L,R;
+
+  /* book-keeping flag, set to true if the spline has been proven to have sufficient accuracy */
+  bool accurate;
+
+  /* fit to tuple of points */
+  Quadratic(double x1, double y1, double x2, double y2, double x3, double y3) {
+    L = x1;
+    R = x3;
+    a = ((y2 - y1)*(x1 - x3) + (y3 - y1)*(x2 - x1)) / ((x1-x3)*(x2*x2-x1*x1) + (x2-x1)*(x3*x3-x1*x1));
+    b = ((y2 - y1) - a*(x2*x2 - x1*x1)) / (x2 - x1);
+    c = y1 - a*x1*x1 - b*x1;
+
+    accurate = false;
+  }
+
+  /* return the value at x */
+  inline double val(double x)const {
+    return a * x * x + b*x + c;
+  }
+
+  /* return value at left */
+  inline double left_val()const {
+    return val(L);
+  }
+  /* return value at right */
+  inline double right_val()const {
+    return val(R);
+  }
+  /* return value at middle */
+  inline double middle_val()const {
+    return val((L + R)/2);
+  }
+};
+
+
+/* a spline for our purposes is a sequence of piecewise quadratic functions and a linear asymptote for the right
+hand side. The function is zero left of the first piece */
+class Spline {
+  public:
+  Spline() : R(0.0), a(0.0), L(0.0) {
+  }
+
+  /* stores the start of the linear asymptote */
+  double R;
+  /* stores the gradient */
+  double a;
+  /* stores the root of the spline */
+  double L;
+
+  /* piece i is A[i]x^2 + B[i]x + C[i] on [X[i], X[i+1]] */
+  std::vector<double> A, B, C;
+  std::vector<double> X;
+
+  size_t size()const {
+    return A.size();
+  }
+
+  /* removes all pieces and releases their memory */
+  void clear() {
+    std::vector<double>().swap(A);
+    std::vector<double>().swap(B);
+    std::vector<double>().swap(C);
+    std::vector<double>().swap(X);
+  }
+
+  /* append a piece, which must start where the previous one ended */
+  void push_back(const Quadratic &q) {
+    if (X.empty()) {
+      X.push_back(q.L);
+    }
+    assert(X.back() == q.L);
+    A.push_back(q.a);
+    B.push_back(q.b);
+    C.push_back(q.c);
+    X.push_back(q.R);
+  }
+
+  /* integrate all functions in the spline with respect to N(u, v). Pieces further than window standard
+  deviations from u are skipped, window <= 0 integrates every piece */
+  double Integrate(double u, double v, double window = SPLINE_WINDOW)const;
+
+  /* as Integrate, also storing the derivative of the integral with respect to u in slope */
+  double IntegrateSlope(double u, double v, double &slope, double window = SPLINE_WINDOW)const;
+
+  /* integrates with respect to N(u[j], v) for j = 0..k-1 */
+  void Integrate(const double *u, double *out, size_t k, double v, double window = SPLINE_WINDOW)const;
+
+  /* return the value at x */
+  double Value(double x)const;
+
+  private:
+  double Evaluate(double u, double v, double window, double *slope)const;
+};
+
+
+/* the number of Gaussian integrals of splines computed so far by the calling thread */
+uint64_t SplineIntegrals();
+
+
+/* y[i] = exp(x[i]) for x[i] <= 0, computed without branches so that the loop vectorises. The relative
+error is a few ulp and arguments below -700 are clamped */
+void ExpNeg(const double *x, double *y, size_t n);
+
+
+/* fits a spline to g on [first.L, first.R], splitting pieces until the quadratic is within tolerance of g at
+the quarter points. g(x, y) evaluates the two points x[0], x[1] into y[0], y[1]. The pieces are appended to
+next in order from left to right */
+template<class G> void Refine(Spline &next, const Quadratic &first, double tolerance, G g) {
+  /* pending pieces, the leftmost is on top */
+  std::vector<Quadratic> stack;
+  stack.reserve(64);
+  stack.push_back(first);
+
+  while (!stack.empty()) {
+    Quadratic q = stack.back();
+    stack.pop_back();
+
+    /* if the spline is known to be accurate then do nothing */
+    if (!q.accurate) {
+      /* otherwise calculate the two midpoints */
+      double m = (q.L + q.R) * 0.5;
+      double x[2] = {(q.L + m) * 0.5, (q.R + m) * 0.5};
+      double y[2];
+      g(x, y);
+
+      /* and the errors with respect to the current spline */
+      double errl = std::abs(y[0] - q.val(x[0]));
+      double errr = std::abs(y[1] - q.val(x[1]));
+
+      /* if the error is large enough, then split the quadratic into two */
+      if (std::max(errl, errr) > tolerance) {
+        Quadratic q1(q.L, q.left_val(), x[0], y[0], m, q.middle_val());
+        Quadratic q2(m, q.middle_val(), x[1], y[1], q.R, q.right_val());
+
+        /* if original spline was accurate in one half, then the new one should be too, so
+        we don't need to check next time (saves some integrals) */
+        q1.accurate = (errl < tolerance);
+        q2.accurate = (errr < tolerance);
+
+        stack.push_back(q2);
+        stack.push_back(q1);
+        continue;
+      }
+    }
+    next.push_back(q);
+  }
+}
@@ -0,0 +1,248 @@
+/***************************************************************************
+LibBandit - Multi-Armed Bandit Library
+Written in 2015 by Tor Lattimore tor.lattimore@gmail.com
+
+To the extent possible under law, the author(s) have dedicated all
+copyright and related and neighboring rights to this software to the
+public domain worldwide. This software is distributed without any warranty.
+
+You should have received a copy of the CC0 Public Domain Dedication
+along with this software. If not,
+see http://creativecommons.org/publicdomain/zero/1.0/
+***************************************************************************/
+
+
+/************************************************************
+Records the arms pulled during a run, and optionally the rewards.
+
+Actions are stored as runs (arm, length) of varints. Once an
+algorithm has settled on the best arm the runs are long, so a run
+of millions of rounds takes a few KB. Rewards are only kept when
+asked for, in segments of 4096 pulls. Each segment starts with a
+flag byte and is XOR coded (see coding.h) if that makes it smaller,
+otherwise the values are stored as they are. Repeated or smooth
+rewards shrink several times, Gaussian rewards are close to random
+bits and stay at 8 bytes per pull.
+
+With a spill file the encoded streams are appended to
+<spill>.actions and <spill>.rewards whenever they exceed limit
+bytes, so memory stays bounded however long the run.
+************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <cstdio>
+
+#include "coding.h"
+
+
+class Trajectory {
+  public:
+  Trajectory(bool rewards = false, std::string spill = "", size_t limit = 1 << 20) : keep_rewards(rewards), spill(spill),
+  limit(limit) {
+    clear();
+  }
+
+  void record(int arm, double reward) {
+    if (arm != arm_ || length == 0) {
+      close_run();
+      arm_ = arm;
+    }
+    length++;
+    count++;
+    if (keep_rewards) {
+      open.push_back(reward);
+      if (open.size() == SEGMENT) {
+        close_segment();
+      }
+    }
+    if (!spill.empty() && actions.size() + rewards.size() >= limit) {
+      flush();
+    }
+  }
+
+  /* forgets everything, including the spilled streams */
+  void clear() {
+    actions.clear();
+    rewards.clear();
+    arm_ = -1;
+    length = 0;
+    count = 0;
+    number = 0;
+    open.clear();
+    if (keep_rewards) {
+      open.reserve(SEGMENT);
+    }
+    if (!spill.empty()) {
+      remove((spill + ".actions").c_str());
+      remove((spill + ".rewards").c_str());
+    }
+  }
+
+  /* appends the encoded streams to the spill files */
+  void flush() {
+    if (spill.empty()) {
+      return;
+    }
+    append(spill + ".actions", actions);
+    append(spill + ".rewards", rewards);
+  }
+
+  uint64_t pulls()const {
+    return count;
+  }
+
+  uint64_t runs()const {
+    return number + (length != 0);
+  }
+
+  bool has_rewards()const {
+    return keep_rewards;
+  }
+
+  /* bytes held in memory */
+  size_t memory()const {
+    return actions.capacity() + rewards.capacity() + open.capacity() * sizeof(double);
+  }
+
+  /* calls f(arm, length) for every run in order */
+  template<class F> void for_each_run(F f)const {
+    Reader<std::string> in(spill.empty() ? "" : spill + ".actions", actions);
+    for (uint64_t r = 0;r != number;++r) {
+      uint64_t arm = GetVarint(in);
+      uint64_t len = GetVarint(in);
+      f((int)arm, len);
+    }
+    if (length != 0) {
+      f(arm_, length);
+    }
+  }
+
+  /* calls f(arm, reward) for every pull in order, only if rewards are kept */
+  template<class F> void for_each_pull(F f)const {
+    assert(keep_rewards);
+    Reader<std::vector<char> > in(spill.empty() ? "" : spill + ".rewards", rewards);
+    /* pulls in closed segments, the rest are in open */
+    uint64_t closed = count - open.size();
+    uint64_t k = 0, p = 0;
+    uint8_t codec = RAW;
+    for_each_run([&](int arm, uint64_t len) {
+      for (uint64_t i = 0;i != len;++i, ++k) {
+        if (k >= closed) {
+          f(arm, open[k - closed]);
+          continue;
+        }
+        if (k % SEGMENT == 0) {
+          codec = in();
+          p = 0;
+        }
+        if (codec == XOR) {
+          f(arm, GetXor(p, in));
+        }else {
+          char bytes[sizeof(double)];
+          for (auto &c : bytes) {
+            c = in();
+          }
+          double x;
+          memcpy(&x, bytes, sizeof(x));
+          f(arm, x);
+        }
+      }
+    });
+  }
+
+  private:
+  enum Codec : uint8_t {RAW = 0, XOR = 1};
+  static const size_t SEGMENT = 4096;
+
+  /* moves the rewards in open to the rewards stream */
+  void close_segment() {
+    std::string coded;
+    uint64_t p = 0;
+    for (double x : open) {
+      PutXor(x, p, coded);
+    }
+    const char *begin;
+    size_t bytes = open.size() * sizeof(double);
+    Codec codec = coded.size() < bytes ? XOR : RAW;
+    if (codec == XOR) {
+      begin = coded.data();
+      bytes = coded.size();
+    }else {
+      begin = (const char*)open.data();
+    }
+    /* grow by an eighth rather than doubling, so kept rewards take little more memory than their size */
+    if (rewards.capacity() < rewards.size() + 1 + bytes) {
+      rewards.reserve(rewards.size() + rewards.size() / 8 + 1 + bytes);
+    }
+    rewards.push_back((char)codec);
+    rewards.insert(rewards.end(), begin, begin + bytes);
+    open.clear();
+  }
+
+  void close_run() {
+    if (length != 0) {
+      PutVarint(arm_, actions);
+      PutVarint(length, actions);
+      number++;
+    }
+    length = 0;
+  }
+
+  template<class S> static void append(std::string fn, S &data) {
+    if (data.empty()) {
+      return;
+    }
+    std::ofstream out(fn, std::ios::app | std::ios::binary);
+    out.write(data.data(), data.size());
+    assert(out);
+    data.clear();
+  }
+
+  /* returns the bytes of a spill file followed by those still in memory */
+  template<class S> class Reader {
+    public:
+    Reader(std::string fn, const S &tail) : tail(tail), pos(0) {
+      if (!fn.empty()) {
+        in.open(fn, std::ios::binary);
+      }
+    }
+
+    uint8_t operator()() {
+      if (in.is_open()) {
+        int c = in.get();
+        if (c != EOF) {
+          return c;
+        }
+        in.close();
+      }
+      assert(pos < tail.size());
+      return tail[pos++];
+    }
+
+    private:
+    std::ifstream in;
+    const S &tail;
+    size_t pos;
+  };
+
+  bool keep_rewards;
+  std::string spill;
+  size_t limit;
+
+  std::string actions;
+  std::vector<char> rewards;
+  /* the open run, not yet in actions */
+  int arm_;
+  uint64_t length;
+  /* pulls, closed runs */
+  uint64_t count;
+  uint64_t number;
+  /* rewards of the open segment */
+  std::vector<double> open;
+};